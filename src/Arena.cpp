@@ -0,0 +1,91 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "Arena.h"
+
+CArena::CArena(size_t blockSize)
+{
+	m_pBlock = NULL;
+	m_pCur = NULL;
+	m_pEnd = NULL;
+	m_blockSize = blockSize;
+	m_used = 0;
+	m_nbString = 0;
+}
+
+CArena::~CArena()
+{
+	while (m_pBlock)
+	{
+		Block *pNext = m_pBlock->pNext;
+		free(m_pBlock);
+		m_pBlock = pNext;
+	}
+}
+
+void	*	CArena::Alloc(size_t size,size_t align)
+{
+	char *p = (char*)(((size_t)m_pCur + align - 1) & ~(align - 1));
+	if ((NULL == m_pCur) || (p + size > m_pEnd))
+	{	// new block (a big allocation gets its own)
+		size_t blockSize = sizeof(Block) + align + size;
+		if (blockSize < m_blockSize)
+			blockSize = m_blockSize;
+		Block *pBlock = (Block*)malloc(blockSize);
+		if (NULL == pBlock)
+			throw std::bad_alloc();
+		pBlock->pNext = m_pBlock;
+		m_pBlock = pBlock;
+		m_pCur = (char*)(pBlock + 1);
+		m_pEnd = (char*)pBlock + blockSize;
+		p = (char*)(((size_t)m_pCur + align - 1) & ~(align - 1));
+	}
+	m_pCur = p + size;
+	m_used += size;
+	return p;
+}
+
+static	size_t	HashString(const char *pStr)
+{
+	size_t h = (size_t)2166136261u;		// FNV-1a
+	for (;*pStr;pStr++)
+		h = (h ^ (unsigned char)*pStr) * 16777619u;
+	return h;
+}
+
+const char	*	CArena::Intern(const char *pStr)
+{
+	if (2 * (m_nbString + 1) > m_strings.size())
+	{	// keep the set half empty
+		std::vector<const char*> old;
+		old.swap(m_strings);
+		m_strings.assign(old.empty() ? 256 : old.size() * 2,(const char*)NULL);
+		size_t mask = m_strings.size() - 1;
+		for (size_t i=0;i<old.size();i++)
+		{
+			if (old[i])
+			{
+				size_t slot = HashString(old[i]) & mask;
+				while (m_strings[slot])
+					slot = (slot + 1) & mask;
+				m_strings[slot] = old[i];
+			}
+		}
+	}
+
+	size_t mask = m_strings.size() - 1;
+	size_t slot = HashString(pStr) & mask;
+	while (m_strings[slot])
+	{
+		if (0 == strcmp(m_strings[slot],pStr))
+			return m_strings[slot];
+		slot = (slot + 1) & mask;
+	}
+
+	size_t len = strlen(pStr) + 1;
+	char *pCopy = (char*)Alloc(len,1);
+	memcpy(pCopy,pStr,len);
+	m_strings[slot] = pCopy;
+	m_nbString++;
+	return pCopy;
+}
@@ -0,0 +1,48 @@
+
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <new>
+#include <stddef.h>
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Bump allocator: small allocations are carved from big blocks, and are all
+// freed at once when the arena goes away. Nothing is destroyed, so it only
+// holds plain data (the directory tree of a job).
+// Intern() keeps one copy of each string.
+// Not thread safe: one arena per job.
+//--------------------------------------------------------------------------
+class CArena
+{
+public:
+	CArena(size_t blockSize = 64*1024);
+	~CArena();
+
+	void		*	Alloc(size_t size,size_t align = sizeof(void*));
+	const char	*	Intern(const char *pStr);
+
+	template <class T>	T*	New()			{ return new (Alloc(sizeof(T),alignof(T))) T; }
+
+	size_t			GetUsed() const			{ return m_used; }
+
+private:
+	CArena(const CArena&);
+	CArena&	operator=(const CArena&);
+
+	struct Block
+	{
+		Block	*	pNext;
+	};
+
+	Block		*	m_pBlock;
+	char		*	m_pCur;
+	char		*	m_pEnd;
+	size_t			m_blockSize;
+	size_t			m_used;
+
+	std::vector<const char*>	m_strings;		// open addressing set of the interned strings
+	size_t						m_nbString;
+};
+
+#endif // __ARENA__
@@ -0,0 +1,783 @@
+
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Bench.h"
+#include "Dir2Floppy.h"
+#include "Msa.h"
+#include "ThreadPool.h"
+
+#include "ZIP/CRC.H"
+#include "ZIP/INFLATE.H"
+#include "ZIP/ZIPIO.H"
+
+// Bump when the inputs or the stages change: results of other versions are not comparable
+static	const	int		BENCH_VERSION		=	2;
+static	const	int		NB_RUN				=	7;
+static	const	int		NB_RUN_FILE_SYSTEM	=	21;			// the stages that touch files are much noisier
+static	const	double	MIN_RUN_MS			=	10.0;		// shorter calls are repeated: timer and scheduler noise
+static	const	double	NOISE_SPREAD		=	2.0;		// slowdowns within that many times the run-to-run spread never fail
+static	const	int		NB_CONFIRM			=	2;			// passes to measure again a stage slower than the baseline
+
+struct BenchStage
+{
+	std::string		name;
+	double			ms;				// for one call: median of the runs, or best run for the file system stages
+	double			spread;			// (median - best) / best of this run: its noise
+	long long		bytes;			// processed by one call (0: not relevant)
+};
+
+//--------------- Synthetic data -----------------------------------------
+
+class CBenchRandom
+{
+public:
+	CBenchRandom(unsigned long long seed)	{ m_state = seed; }
+	unsigned int	Next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 7;
+		m_state ^= m_state << 17;
+		return (unsigned int)(m_state >> 32);
+	}
+	int		Range(int min,int max)		{ return min + (int)(Next() % (unsigned int)(max - min + 1)); }
+
+private:
+	unsigned long long	m_state;
+};
+
+static	void	FillRandom(unsigned char *p,size_t size,CBenchRandom &rnd)
+{
+	for (size_t i=0;i<size;i++)
+		p[i] = (unsigned char)rnd.Next();
+}
+
+// Runs of a few to a few hundred bytes, like sprites or sample silences
+static	void	FillRle(unsigned char *p,size_t size,CBenchRandom &rnd)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t len = std::min((size_t)rnd.Range(4,300),size - i);
+		memset(p + i,(rnd.Next() & 3) ? 0 : (int)(rnd.Next() & 0xff),len);
+		i += len;
+		if ((i < size) && (rnd.Next() & 1))
+			p[i++] = (unsigned char)rnd.Next();
+	}
+}
+
+//--------------- Deflate (fixed codes, distance 1 runs) -----------------
+
+class CBitWriter
+{
+public:
+	CBitWriter(std::vector<unsigned char> &out) : m_out(out)	{ m_bits = 0; m_nbBit = 0; }
+
+	void	Put(unsigned int value,int nbBit)
+	{
+		m_bits |= value << m_nbBit;
+		m_nbBit += nbBit;
+		while (m_nbBit >= 8)
+		{
+			m_out.push_back((unsigned char)m_bits);
+			m_bits >>= 8;
+			m_nbBit -= 8;
+		}
+	}
+
+	// Huffman codes are sent from their most significant bit
+	void	PutCode(unsigned int code,int len)
+	{
+		unsigned int rev = 0;
+		for (int i=0;i<len;i++)
+			rev |= ((code >> i) & 1) << (len - 1 - i);
+		Put(rev,len);
+	}
+
+	void	Flush()
+	{
+		if (m_nbBit > 0)
+			m_out.push_back((unsigned char)m_bits);
+		m_bits = 0;
+		m_nbBit = 0;
+	}
+
+private:
+	std::vector<unsigned char>	&	m_out;
+	unsigned int					m_bits;
+	int								m_nbBit;
+};
+
+static	void	PutSymbol(CBitWriter &bits,int s)
+{
+	if (s < 144)
+		bits.PutCode(0x30 + s,8);
+	else if (s < 256)
+		bits.PutCode(0x190 + s - 144,9);
+	else if (s < 280)
+		bits.PutCode(s - 256,7);
+	else
+		bits.PutCode(0xc0 + s - 280,8);
+}
+
+// Length (3..258) and distance (1..32768) pair
+static	void	PutMatch(CBitWriter &bits,int length,int distance)
+{
+	static const int LENGTH_BASE[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+	static const int LENGTH_EXTRA[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+	static const int DISTANCE_BASE[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+	static const int DISTANCE_EXTRA[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+	int code = 28;
+	while (LENGTH_BASE[code] > length)
+		code--;
+	PutSymbol(bits,257 + code);
+	bits.Put((unsigned int)(length - LENGTH_BASE[code]),LENGTH_EXTRA[code]);
+
+	code = 29;
+	while (DISTANCE_BASE[code] > distance)
+		code--;
+	bits.PutCode(code,5);
+	bits.Put((unsigned int)(distance - DISTANCE_BASE[code]),DISTANCE_EXTRA[code]);
+}
+
+// Enough for inflate to work on real matches: runs become copies of the previous byte
+static	void	DeflateFixed(const unsigned char *pSrc,size_t size,std::vector<unsigned char> &out)
+{
+	out.clear();
+	CBitWriter bits(out);
+	bits.Put(1,1);			// last block
+	bits.Put(1,2);			// fixed codes
+
+	size_t i = 0;
+	while (i < size)
+	{
+		PutSymbol(bits,pSrc[i]);
+		size_t run = 0;
+		while ((i + 1 + run < size) && (run < 258) && (pSrc[i + 1 + run] == pSrc[i]))
+			run++;
+		i++;
+		if (run >= 3)
+		{
+			PutMatch(bits,(int)run,1);
+			i += run;
+		}
+	}
+	PutSymbol(bits,256);
+	bits.Flush();
+}
+
+//--------------- Input files --------------------------------------------
+
+static	bool	WriteBenchFile(const char *pName,const void *pData,size_t size)
+{
+	FILE *h = fopen(pName,"wb");
+	if (NULL == h)
+		return false;
+	bool bOk = (0 == size) || (size == fwrite(pData,1,size,h));
+	return (0 == fclose(h)) && bOk;
+}
+
+static	void	PutLE(std::vector<unsigned char> &out,unsigned int v,int nbByte)
+{
+	for (int i=0;i<nbByte;i++)
+		out.push_back((unsigned char)(v >> (i * 8)));
+}
+
+struct BenchMember
+{
+	std::string					name;
+	std::vector<unsigned char>	data;
+	bool						bDeflate;
+};
+
+static	bool	WriteBenchZip(const char *pName,const std::vector<BenchMember> &members)
+{
+	std::vector<unsigned char> zip;
+	std::vector<unsigned char> dir;
+	std::vector<unsigned char> packed;
+	for (size_t i=0;i<members.size();i++)
+	{
+		const BenchMember &m = members[i];
+		unsigned int crc = (unsigned int)(CrcUpdate(0xffffffffL,(unsigned char*)m.data.data(),(long)m.data.size()) ^ 0xffffffffL);
+		if (m.bDeflate)
+			DeflateFixed(m.data.data(),m.data.size(),packed);
+		else
+			packed = m.data;
+
+		unsigned int offset = (unsigned int)zip.size();
+		PutLE(zip,0x04034b50,4);
+		PutLE(zip,20,2);
+		PutLE(zip,0,2);
+		PutLE(zip,m.bDeflate ? 8 : 0,2);
+		PutLE(zip,0,2);							// time
+		PutLE(zip,(10 << 9) | (1 << 5) | 1,2);	// date: 1990-01-01
+		PutLE(zip,crc,4);
+		PutLE(zip,(unsigned int)packed.size(),4);
+		PutLE(zip,(unsigned int)m.data.size(),4);
+		PutLE(zip,(unsigned int)m.name.size(),2);
+		PutLE(zip,0,2);
+		zip.insert(zip.end(),m.name.begin(),m.name.end());
+		zip.insert(zip.end(),packed.begin(),packed.end());
+
+		PutLE(dir,0x02014b50,4);
+		PutLE(dir,20,2);
+		PutLE(dir,20,2);
+		PutLE(dir,0,2);
+		PutLE(dir,m.bDeflate ? 8 : 0,2);
+		PutLE(dir,0,2);
+		PutLE(dir,(10 << 9) | (1 << 5) | 1,2);
+		PutLE(dir,crc,4);
+		PutLE(dir,(unsigned int)packed.size(),4);
+		PutLE(dir,(unsigned int)m.data.size(),4);
+		PutLE(dir,(unsigned int)m.name.size(),2);
+		PutLE(dir,0,2);
+		PutLE(dir,0,2);
+		PutLE(dir,0,2);
+		PutLE(dir,0,2);
+		PutLE(dir,0,4);
+		PutLE(dir,offset,4);
+		dir.insert(dir.end(),m.name.begin(),m.name.end());
+	}
+
+	unsigned int dirOffset = (unsigned int)zip.size();
+	zip.insert(zip.end(),dir.begin(),dir.end());
+	PutLE(zip,0x06054b50,4);
+	PutLE(zip,0,2);
+	PutLE(zip,0,2);
+	PutLE(zip,(unsigned int)members.size(),2);
+	PutLE(zip,(unsigned int)members.size(),2);
+	PutLE(zip,(unsigned int)dir.size(),4);
+	PutLE(zip,dirOffset,4);
+	PutLE(zip,0,2);
+	return WriteBenchFile(pName,zip.data(),zip.size());
+}
+
+static	bool	MakeDeepTree(const std::string &path,int depth,int fanout,int nbFile)
+{
+	if (!HostMakeDir(path.c_str()))
+		return false;
+	char sName[32];
+	for (int i=0;i<nbFile;i++)
+	{
+		sprintf(sName,"/FILE%d.DAT",i);
+		if (!WriteBenchFile((path + sName).c_str(),NULL,0))
+			return false;
+	}
+	if (depth > 0)
+	{
+		for (int i=0;i<fanout;i++)
+		{
+			sprintf(sName,"/DIR%d",i);
+			if (!MakeDeepTree(path + sName,depth - 1,fanout,nbFile))
+				return false;
+		}
+	}
+	return true;
+}
+
+struct BenchInputs
+{
+	std::string		deepDir;		// 1365 directories, 2 empty files each
+	std::string		wideDir;		// 4000 empty files in one directory
+	std::string		fillDir;		// fits the default floppy: random and RLE files in 4 directories
+	std::string		tinyZip;		// 2000 members of 0-200 bytes, stored and deflated
+	std::string		largeZip;		// 4 deflated members of 1 MB
+	std::string		imageName;		// output of the write stages
+	std::vector<unsigned char>	deflated;		// raw deflate stream of 4 MB (half random, half RLE)
+	long long		inflatedSize;
+};
+
+static	bool	MakeInputs(const char *pWorkDir,BenchInputs &in)
+{
+	CBenchRandom rnd(0x2545f4914f6cdd1dULL);
+	std::string root = pWorkDir;
+	if (!HostMakeDir(root.c_str()))
+		return false;
+
+	in.deepDir = root + "/deep";
+	in.wideDir = root + "/wide";
+	in.fillDir = root + "/fill";
+	in.tinyZip = root + "/tiny.zip";
+	in.largeZip = root + "/large.zip";
+	in.imageName = root + "/out.msa";
+
+	if (!MakeDeepTree(in.deepDir,5,4,2))
+		return false;
+
+	if (!HostMakeDir(in.wideDir.c_str()))
+		return false;
+	char sName[64];
+	for (int i=0;i<4000;i++)
+	{
+		sprintf(sName,"/F%05d.DAT",i);
+		if (!WriteBenchFile((in.wideDir + sName).c_str(),NULL,0))
+			return false;
+	}
+
+	if (!HostMakeDir(in.fillDir.c_str()))
+		return false;
+	std::vector<unsigned char> data;
+	for (int d=0;d<4;d++)
+	{
+		sprintf(sName,"/PART%d",d);
+		std::string dir = in.fillDir + sName;
+		if (!HostMakeDir(dir.c_str()))
+			return false;
+		for (int i=0;i<40;i++)
+		{
+			data.resize(rnd.Range(100,7000));
+			if (i & 1)
+				FillRandom(data.data(),data.size(),rnd);
+			else
+				FillRle(data.data(),data.size(),rnd);
+			sprintf(sName,"/DATA%02d.BIN",i);
+			if (!WriteBenchFile((dir + sName).c_str(),data.data(),data.size()))
+				return false;
+		}
+	}
+
+	std::vector<BenchMember> members(2000);
+	for (size_t i=0;i<members.size();i++)
+	{
+		sprintf(sName,"D%d/T%04d.TXT",(int)(i / 100),(int)i);
+		members[i].name = sName;
+		members[i].data.resize(rnd.Range(0,200));
+		FillRle(members[i].data.data(),members[i].data.size(),rnd);
+		members[i].bDeflate = (0 != (i & 1));
+	}
+	if (!WriteBenchZip(in.tinyZip.c_str(),members))
+		return false;
+
+	members.resize(4);
+	for (size_t i=0;i<members.size();i++)
+	{
+		sprintf(sName,"BIG%d.BIN",(int)i);
+		members[i].name = sName;
+		members[i].data.resize(1 << 20);
+		if (i & 1)
+			FillRandom(members[i].data.data(),members[i].data.size(),rnd);
+		else
+			FillRle(members[i].data.data(),members[i].data.size(),rnd);
+		members[i].bDeflate = true;
+	}
+	if (!WriteBenchZip(in.largeZip.c_str(),members))
+		return false;
+
+	data.resize(4 << 20);
+	FillRandom(data.data(),data.size() / 2,rnd);
+	FillRle(data.data() + data.size() / 2,data.size() / 2,rnd);
+	DeflateFixed(data.data(),data.size(),in.deflated);
+	in.inflatedSize = (long long)data.size();
+	return true;
+}
+
+//--------------- Stages -------------------------------------------------
+
+// The file system stages keep their best run: the page and directory caches, and the
+// writeback of the inputs just generated, only ever make a run slower
+static	void	Measure(std::vector<BenchStage> &stages,const char *pName,long long bytes,int nbRepeat,bool bFileSystem,const std::function<void()> &run)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	run();			// warm up (caches, first touch)
+	double warmMs = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - t0).count();
+	if (warmMs * nbRepeat < MIN_RUN_MS)
+		nbRepeat = std::min((int)(MIN_RUN_MS / std::max(warmMs,0.001)) + 1,100000);
+
+	std::vector<double> times;
+	int nbRun = bFileSystem ? NB_RUN_FILE_SYSTEM : NB_RUN;
+	for (int r=0;r<nbRun;r++)
+	{
+		t0 = std::chrono::steady_clock::now();
+		for (int i=0;i<nbRepeat;i++)
+			run();
+		times.push_back(std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - t0).count() / nbRepeat);
+	}
+	std::sort(times.begin(),times.end());
+
+	BenchStage stage;
+	stage.name = pName;
+	double median = times[times.size() / 2];
+	stage.ms = bFileSystem ? times[0] : median;
+	stage.spread = (times[0] > 0.0) ? (median - times[0]) / times[0] : 0.0;
+	stage.bytes = bytes;
+	stages.push_back(stage);
+
+	printf("  %-18s %10.3f ms",pName,stage.ms);
+	if (bytes > 0)
+		printf("  %8.1f MB/s",(double)bytes / (stage.ms * 1000.0));
+	printf("\n");
+}
+
+static	int		InflateSink(void *pAppState,unsigned char * /*pBuffer*/,long length)
+{
+	*(long long*)pAppState += length;
+	return 0;
+}
+
+static	void*	InflateMalloc(long length)	{ return malloc((size_t)length); }
+static	void	InflateFree(void *pBuffer)	{ free(pBuffer); }
+
+static	int		InflateKeep(void *pAppState,unsigned char *pBuffer,long length)
+{
+	std::vector<unsigned char> *pOut = (std::vector<unsigned char>*)pAppState;
+	pOut->insert(pOut->end(),pBuffer,pBuffer + length);
+	return 0;
+}
+
+// A 258 byte match that ends exactly on the 32K window boundary, then a copy
+// from the byte after it (window position 0)
+static	bool	CheckInflateWindowEdge()
+{
+	std::vector<unsigned char> data(32510);
+	CBenchRandom rnd(32768);
+	FillRandom(data.data(),data.size(),rnd);
+
+	std::vector<unsigned char> packed;
+	CBitWriter bits(packed);
+	bits.Put(1,1);			// last block
+	bits.Put(1,2);			// fixed codes
+	for (size_t i=0;i<data.size();i++)
+		PutSymbol(bits,data[i]);
+	PutMatch(bits,258,1000);
+	for (int i=0;i<258;i++)
+		data.push_back(data[data.size() - 1000]);
+	for (int i=0;i<400;i++)
+	{
+		data.push_back((unsigned char)(i * 7 + 1));
+		PutSymbol(bits,data.back());
+	}
+	PutMatch(bits,100,400);
+	for (int i=0;i<100;i++)
+		data.push_back(data[data.size() - 400]);
+	PutSymbol(bits,256);
+	bits.Flush();
+
+	std::vector<unsigned char> out;
+	void *pState = InflateInitialize(&out,InflateKeep,InflateMalloc,InflateFree);
+	bool bOk = (0 == InflatePutBuffer(pState,packed.data(),(long)packed.size()));
+	bOk &= (0 == InflateTerminate(pState));
+	return bOk && (out == data);
+}
+
+static	long long	FileSize(const char *pName)
+{
+	CMappedFile file;
+	return file.Open(pName) ? (long long)file.GetSize() : 0;
+}
+
+static	bool	RunStages(const BenchInputs &in,std::vector<BenchStage> &stages)
+{
+	bool bOk = true;
+
+	Measure(stages,"scan_deep",0,1,true,[&]
+	{
+		CArena arena;
+		CreateTreeFromDirectory(in.deepDir.c_str(),&arena);
+	});
+
+	Measure(stages,"scan_wide",0,1,true,[&]
+	{
+		CArena arena;
+		CreateTreeFromDirectory(in.wideDir.c_str(),&arena);
+	});
+
+	Measure(stages,"zip_walk_tiny",FileSize(in.tinyZip.c_str()),1,false,[&]
+	{
+		ZFILE *pZIP = zopen(in.tinyZip.c_str(),"rb");
+		int nbMember = 0;
+		if (pZIP)
+		{
+			for (nbMember=1;0 == znext(pZIP);nbMember++)
+				;
+			zclose(pZIP);
+		}
+		bOk &= (2000 == nbMember);
+	});
+
+	Measure(stages,"zip_index_tiny",0,1,false,[&]
+	{
+		CArena arena;
+		ZFILE *pZIP = zopen(in.tinyZip.c_str(),"rb");
+		bOk &= pZIP && (NULL != CreateTreeFromZIP(pZIP,&arena));
+		if (pZIP)
+			zclose(pZIP);
+	});
+
+	std::vector<unsigned char> buffer(1 << 20);
+	Measure(stages,"zip_extract_large",4 << 20,1,false,[&]
+	{
+		ZFILE *pZIP = zopen(in.largeZip.c_str(),"rb");
+		bOk &= (NULL != pZIP);
+		if (pZIP)
+		{
+			for (int i=0;i<4;i++)
+				bOk &= (0 == zextract(pZIP,i,buffer.data(),(unsigned long)buffer.size()));
+			zclose(pZIP);
+		}
+	});
+
+	// same, the way the builds read it: mapped, inflated in place
+	Measure(stages,"zip_extract_mapped",4 << 20,1,false,[&]
+	{
+		CZIPFileSource source(in.largeZip.c_str());
+		ZFILE *pZIP = source.Open();
+		bOk &= (NULL != pZIP);
+		if (pZIP)
+		{
+			for (int i=0;i<4;i++)
+				bOk &= (0 == zextract(pZIP,i,buffer.data(),(unsigned long)buffer.size()));
+			zclose(pZIP);
+		}
+	});
+
+	Measure(stages,"inflate",in.inflatedSize,1,false,[&]
+	{
+		long long nbOut = 0;
+		void *pState = InflateInitialize(&nbOut,InflateSink,InflateMalloc,InflateFree);
+		const long CHUNK = 64 * 1024;
+		for (size_t i=0;i<in.deflated.size();i+=CHUNK)
+		{
+			long len = (long)std::min((size_t)CHUNK,in.deflated.size() - i);
+			bOk &= (0 == InflatePutBuffer(pState,(unsigned char*)in.deflated.data() + i,len));
+		}
+		bOk &= (0 == InflateTerminate(pState)) && (nbOut == in.inflatedSize);
+	});
+
+	std::vector<unsigned char> crcData(16 << 20);
+	CBenchRandom rnd(12345);
+	FillRandom(crcData.data(),crcData.size(),rnd);
+	volatile unsigned long crc = 0;
+	Measure(stages,"crc",(long long)crcData.size(),1,false,[&]
+	{
+		crc = CrcUpdate(0xffffffffL,crcData.data(),(long)crcData.size());
+	});
+
+	// 160 tracks of each kind
+	const int TRACK_SIZE = 10 * 512;
+	const int NB_TRACK = 160;
+	std::vector<unsigned char> tracks(NB_TRACK * TRACK_SIZE);
+	std::vector<unsigned char> packed(MsaTrackSlotSize(TRACK_SIZE));
+	FillRandom(tracks.data(),tracks.size(),rnd);
+	Measure(stages,"msa_pack_random",(long long)tracks.size(),1,false,[&]
+	{
+		for (int t=0;t<NB_TRACK;t++)
+			MsaPackTrack(tracks.data() + t * TRACK_SIZE,TRACK_SIZE,packed.data());
+	});
+	FillRle(tracks.data(),tracks.size(),rnd);
+	Measure(stages,"msa_pack_rle",(long long)tracks.size(),1,false,[&]
+	{
+		for (int t=0;t<NB_TRACK;t++)
+			MsaPackTrack(tracks.data() + t * TRACK_SIZE,TRACK_SIZE,packed.data());
+	});
+
+	CArena arena;
+	CDirectory *pTree = CreateTreeFromDirectory(in.fillDir.c_str(),&arena);
+	CFloppy floppy;
+	floppy.SetVerbosity(VERBOSE_QUIET);
+	const DiskGeometry &geometry = GetDefaultGeometry();
+	long long rawSize = (long long)geometry.GetNbSector() * 512;
+	Measure(stages,"fill",0,20,false,[&]
+	{
+		floppy.Create(geometry);
+		bOk &= floppy.Fill(pTree);
+	});
+
+	Measure(stages,"fat_flush",0,100,false,[&]
+	{
+		floppy.FAT_Flush();
+	});
+
+	CThreadPool pool;
+	CHostFileSource source;
+	Measure(stages,"load_host",0,1,true,[&]
+	{
+		bOk &= floppy.LoadFiles(&source,&pool);
+	});
+
+	Measure(stages,"write_msa",rawSize,1,true,[&]
+	{
+		bOk &= floppy.WriteMSA(in.imageName.c_str(),&pool);
+	});
+
+	return bOk;
+}
+
+//--------------- Results ------------------------------------------------
+
+static	bool	WriteResults(const char *pName,const std::vector<BenchStage> &stages)
+{
+	FILE *h = fopen(pName,"w");
+	if (NULL == h)
+		return false;
+	fprintf(h,"{\n\t\"benchmark\": \"dir2msa\",\n\t\"version\": %d,\n\t\"threads\": %d,\n\t\"stages\": [\n",BENCH_VERSION,CThreadPool::DefaultThreadCount());
+	for (size_t i=0;i<stages.size();i++)
+	{
+		fprintf(h,"\t\t{ \"name\": \"%s\", \"ms\": %.4f, \"spread\": %.4f, \"bytes\": %lld }%s\n",
+				stages[i].name.c_str(),stages[i].ms,stages[i].spread,stages[i].bytes,(i + 1 < stages.size()) ? "," : "");
+	}
+	fprintf(h,"\t]\n}\n");
+	return 0 == fclose(h);
+}
+
+// Only reads back what WriteResults writes
+static	bool	ReadResults(const char *pName,int *pVersion,std::map<std::string,BenchStage> &stages)
+{
+	CMappedFile file;
+	if (!file.Open(pName))
+		return false;
+	std::string json((const char*)file.GetData(),file.GetSize());
+
+	size_t pos = json.find("\"version\":");
+	if (std::string::npos == pos)
+		return false;
+	*pVersion = atoi(json.c_str() + pos + 10);
+
+	while (std::string::npos != (pos = json.find("\"name\": \"",pos)))
+	{
+		pos += 9;
+		size_t end = json.find('"',pos);
+		size_t msPos = json.find("\"ms\":",pos);
+		size_t spreadPos = json.find("\"spread\":",pos);
+		if ((std::string::npos == end) || (std::string::npos == msPos) || (std::string::npos == spreadPos))
+			return false;
+		BenchStage &stage = stages[json.substr(pos,end - pos)];
+		stage.ms = atof(json.c_str() + msPos + 5);
+		stage.spread = atof(json.c_str() + spreadPos + 9);
+		pos = end;
+	}
+	return !stages.empty();
+}
+
+static	bool	IsRegression(const BenchStage &stage,const BenchStage &base,double threshold,double *pChange)
+{
+	*pChange = (base.ms > 0.0) ? (stage.ms - base.ms) * 100.0 / base.ms : 0.0;
+	double noise = NOISE_SPREAD * std::max(stage.spread,base.spread) * 100.0;		// of either run
+	return (*pChange > threshold) && (*pChange > noise);
+}
+
+static	int		CountRegressions(const std::vector<BenchStage> &stages,const std::map<std::string,BenchStage> &baseline,double threshold)
+{
+	int nbRegression = 0;
+	for (size_t i=0;i<stages.size();i++)
+	{
+		std::map<std::string,BenchStage>::const_iterator it = baseline.find(stages[i].name);
+		double change;
+		if ((it != baseline.end()) && IsRegression(stages[i],it->second,threshold,&change))
+			nbRegression++;
+	}
+	return nbRegression;
+}
+
+static	int		CompareResults(const std::vector<BenchStage> &stages,const std::map<std::string,BenchStage> &baseline,const BenchOptions &options)
+{
+	printf("\nAgainst \"%s\" (regression above +%.1f%%):\n",options.pBaselineName,options.threshold);
+	int nbRegression = 0;
+	for (size_t i=0;i<stages.size();i++)
+	{
+		std::map<std::string,BenchStage>::const_iterator it = baseline.find(stages[i].name);
+		if (it == baseline.end())
+		{
+			printf("  %-18s %10.3f ms  (new)\n",stages[i].name.c_str(),stages[i].ms);
+			continue;
+		}
+		double change;
+		bool bRegression = IsRegression(stages[i],it->second,options.threshold,&change);
+		bool bSlower = (change > options.threshold);
+		printf("  %-18s %10.3f ms  %10.3f ms  %+7.1f%%%s\n",stages[i].name.c_str(),stages[i].ms,it->second.ms,change,
+				bRegression ? "  REGRESSION" : bSlower ? "  (within noise)" : "");
+		if (bRegression)
+			nbRegression++;
+	}
+	printf("%d regression(s)\n",nbRegression);
+	return nbRegression ? 1 : 0;
+}
+
+int		RunBench(const BenchOptions &options)
+{
+	char sWorkDir[_MAX_PATH];
+	HostTempDir(sWorkDir);
+	strcat(sWorkDir,"/dir2msa_bench");
+
+	if (!CheckInflateWindowEdge())
+	{
+		printf("ERROR: inflate decodes a match ending on the window boundary wrong\n");
+		return -1;
+	}
+
+	std::map<std::string,BenchStage> baseline;
+	if (options.pBaselineName)
+	{
+		int version = 0;
+		if (!ReadResults(options.pBaselineName,&version,baseline))
+		{
+			printf("ERROR: Could not read baseline \"%s\"\n",options.pBaselineName);
+			return -1;
+		}
+		if (BENCH_VERSION != version)
+		{
+			printf("ERROR: Baseline \"%s\" is from another benchmark version (%d, not %d)\n",options.pBaselineName,version,BENCH_VERSION);
+			return -1;
+		}
+	}
+
+	printf("Generating inputs in \"%s\"...\n",sWorkDir);
+	BenchInputs inputs;
+	bool bInputs = MakeInputs(sWorkDir,inputs);
+	std::vector<BenchStage> stages;
+	bool bStages = false;
+	if (bInputs)
+	{
+		printf("Stages (median of %d runs, best of %d for the file system ones):\n",NB_RUN,NB_RUN_FILE_SYSTEM);
+		bStages = RunStages(inputs,stages);
+
+		// a slowdown of the whole machine (other processes, frequency), or of one generation
+		// of the input files (directory layout), hits every run of a stage: a regression only
+		// counts if measuring again, on new inputs, shows it too
+		for (int pass=0;bStages && (pass < NB_CONFIRM) && (CountRegressions(stages,baseline,options.threshold) > 0);pass++)
+		{
+			printf("Slower than the baseline, measuring again:\n");
+			HostRemoveTree(sWorkDir);
+			std::vector<BenchStage> again;
+			bStages = MakeInputs(sWorkDir,inputs) && RunStages(inputs,again);
+			for (size_t i=0;bStages && (i<stages.size());i++)
+			{
+				if (again[i].ms < stages[i].ms)
+					stages[i] = again[i];
+			}
+		}
+	}
+
+	// the inputs are generated again by every run (about 5400 files): don't leave them
+	if (!HostRemoveTree(sWorkDir))
+		printf("WARNING: Could not remove \"%s\"\n",sWorkDir);
+
+	if (!bInputs)
+	{
+		printf("ERROR: Could not write the benchmark inputs\n");
+		return -1;
+	}
+	if (!bStages)
+	{
+		printf("ERROR: A stage failed, timings are not meaningful\n");
+		return -1;
+	}
+
+	if (options.pResultName && !WriteResults(options.pResultName,stages))
+	{
+		printf("ERROR: Could not write \"%s\"\n",options.pResultName);
+		return -1;
+	}
+
+	if (options.pBaselineName)
+		return CompareResults(stages,baseline,options);
+	return 0;
+}
@@ -0,0 +1,24 @@
+
+#ifndef __BENCH__
+#define __BENCH__
+
+//--------------------------------------------------------------------------
+// Built-in benchmark (-bench). Synthetic inputs are generated from a fixed
+// seed in the temp directory (removed at the end), then every pipeline stage
+// is timed on its own (median of several runs, best run for the file system
+// stages). Results go to a JSON file; with a baseline JSON the run fails when
+// a stage is still slower by more than the threshold, and more than its noise,
+// after being measured again.
+//--------------------------------------------------------------------------
+
+struct BenchOptions
+{
+	const char	*	pResultName;		// JSON output, NULL: only print
+	const char	*	pBaselineName;		// previous JSON to compare with, NULL: none
+	double			threshold;			// allowed slowdown, in percent
+};
+
+// 0: ok, 1: regression against the baseline, -1: error
+int		RunBench(const BenchOptions &options);
+
+#endif // __BENCH__
@@ -1,31 +1,53 @@
 
-#include <windows.h>
+#include "Platform.h"
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <io.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Arena.h"
+#include "Bench.h"
 #include "Dir2Floppy.h"
+#include "ImageCache.h"
+#include "ImageReader.h"
+#include "Msa.h"
+#include "Server.h"
+#include "ThreadPool.h"
 
-#include "zip/zipio.h"
+#include "ZIP/ZIPIO.H"
 
-//--------------- Disk geometry ----------------------------------------
-static	const	int		NB_SECTOR_PER_TRACK	=	10;
-static	const	int		NB_CYLINDER			=	81;
-static	const	int		NB_HEAD				=	2;
-
-//--------------- Filesystem geometry ----------------------------------
-static	const	int		MAX_ROOT_ENTRY		=	112;
-static	const	int		SECTOR_PER_FAT		=	5;
-static	const	int		ROOTDIR_NBSECTOR	=	(MAX_ROOT_ENTRY*32)/512;
+// Bigger files are recorded with this size: they fail on space (not on int overflows)
+static	const	DWORD	MAX_FILE_SIZE		=	0x7fff0000;
 
 
 
 
 CFloppy::CFloppy()
 {
+	m_pRoot = NULL;
 	m_pRawImage = NULL;
+	m_pMsaImage = NULL;
 	m_pFat = NULL;
+	m_rawCapacity = 0;
+	m_msaCapacity = 0;
+	m_fatCapacity = 0;
+	m_nbSeek = 0;
+	m_seekDistance = 0;
+	m_verbosity = VERBOSE_NORMAL;
+	m_pStats = NULL;
+	m_bMaxFileTime = false;
 }
 
 CFloppy::~CFloppy()
@@ -41,41 +63,92 @@ void	CFloppy::Destroy()
 		m_pRawImage = NULL;
 	}
 
+	if (m_pMsaImage)
+	{
+		delete [] m_pMsaImage;
+		m_pMsaImage = NULL;
+	}
+
 	if (m_pFat)
 	{
 		delete [] m_pFat;
 		m_pFat = NULL;
 	}
+
+	m_rawCapacity = 0;
+	m_msaCapacity = 0;
+	m_fatCapacity = 0;
 }
 
 
+CFloppyPool::~CFloppyPool()
+{
+	for (size_t i=0;i<m_free.size();i++)
+		delete m_free[i];
+}
+
+CFloppy	*	CFloppyPool::Take()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_free.empty())
+		{
+			CFloppy *pFloppy = m_free.back();
+			m_free.pop_back();
+			return pFloppy;
+		}
+	}
+	return new CFloppy;
+}
 
-bool	CFloppy::Create(int nbSide,int nbSectorPerTrack,int nbCylinder)
+void	CFloppyPool::Give(CFloppy *pFloppy)
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_free.push_back(pFloppy);
+}
 
-	Destroy();
 
-	m_nbSide = nbSide;
-	m_nbCylinder = nbCylinder;
-	m_nbSectorPerTrack = nbSectorPerTrack;
-	m_rawSize = nbSide * nbSectorPerTrack * nbCylinder * 512;
+void	CFloppy::SetMaxFileTime(long long t)
+{
+	m_bMaxFileTime = (t >= 0);
+	if (m_bMaxFileTime)
+		UnixTimeToFileTime(t,&m_maxFileTime);
+}
+
+// Buffers are kept from one Create to the next (a batch worker builds many images with the same CFloppy)
+bool	CFloppy::Create(const DiskGeometry &geometry)
+{
 
-	m_pRawImage = new unsigned char [m_rawSize];
+	m_nbSide = geometry.nbSide;
+	m_nbCylinder = geometry.nbCylinder;
+	m_nbSectorPerTrack = geometry.nbSectorPerTrack;
+	m_nbRootEntry = geometry.nbRootEntry;
+	m_nbRootSector = geometry.GetNbRootSector();
+	m_sectorPerFat = geometry.GetSectorPerFat();
+	m_rawSize = geometry.GetNbSector() * 512;
+
+	if (m_rawSize > m_rawCapacity)
+	{
+		delete [] m_pRawImage;
+		m_pRawImage = new unsigned char [m_rawSize];
+		m_rawCapacity = m_rawSize;
+	}
 
 	if (m_pRawImage)
 	{
-		// Fill the raw image
-		memset(m_pRawImage,0xe5,m_rawSize);
+		// Tracks are filled with 0xe5 when first written to (see TouchRaw)
+		m_trackDirty.assign(m_nbSide * m_nbCylinder,0);
+		TouchRaw(m_pRawImage,512);
 
 		// Build the bootsector
 		w16(0xb,512);				// byte per sector
 		w8(0xd,2);					// sector per cluster
 		w16(0xe,1);					// reserved sector (boot sector)
 		w8(0x10,2);					// number of fat !! (2 fat per disk)
-		w16(0x11,MAX_ROOT_ENTRY);	// Nb root entries
-		w16(0x13,nbSide * nbSectorPerTrack * nbCylinder);	// total sectors
+		w16(0x11,m_nbRootEntry);	// Nb root entries
+		w16(0x13,geometry.GetNbSector());	// total sectors
 		w8(0x15,0xf7);				// media type
-		w16(0x16,SECTOR_PER_FAT);	// sectors per fat
+		w16(0x16,m_sectorPerFat);	// sectors per fat
 		w16(0x18,m_nbSectorPerTrack);
 		w16(0x1a,m_nbSide);
 
@@ -84,12 +157,17 @@ bool	CFloppy::Create(int nbSide,int nbSectorPerTrack,int nbCylinder)
 		w16(0x1c,0);
 		memset(m_pRawImage + 0x1e,0x4e,30);
 
-		int nbFsSector = 1 + SECTOR_PER_FAT * 2 + ROOTDIR_NBSECTOR;
-		int nbDataSector = nbSide * nbSectorPerTrack * nbCylinder - nbFsSector;
-		m_maxFatEntry = (nbDataSector / 2);
-		m_nbFreeCluster = m_maxFatEntry;
+		m_nbFreeCluster = geometry.GetNbCluster();
+		m_maxFatEntry = m_nbFreeCluster + 2;		// clusters are numbered from 2
 		m_nextCluster = 2;
-		m_pFat = new int [m_maxFatEntry];
+		m_nbSeek = 0;
+		m_seekDistance = 0;
+		if (m_maxFatEntry > m_fatCapacity)
+		{
+			delete [] m_pFat;
+			m_pFat = new int [m_maxFatEntry];
+			m_fatCapacity = m_maxFatEntry;
+		}
 		memset(m_pFat,0,m_maxFatEntry * sizeof(int));
 
 
@@ -99,82 +177,238 @@ bool	CFloppy::Create(int nbSide,int nbSectorPerTrack,int nbCylinder)
 	return (NULL != m_pRawImage);
 }
 
-CDirEntry::CDirEntry()
+void	CDirEntry::Create(const FileDescriptor *pInfo,CDirectory *pParent,CDirectory *pSubDir,int zipIndex,CArena *pArena)
 {
-	m_pNext = NULL;
-	m_pDirectory = NULL;
-	m_pFileData = NULL;
+	m_pLongName = pArena->Intern(pInfo->cFileName);
+	m_pName = *pInfo->cAlternateFileName ? pArena->Intern(pInfo->cAlternateFileName) : m_pLongName;
+	m_pParent = pParent;
+	m_pDirectory = pSubDir;
+	m_time = pInfo->ftLastWriteTime;
+	m_size = pInfo->nFileSizeLow;
+	m_zipIndex = zipIndex;
+	m_firstCluster = 0;
 }
 
-CDirEntry::~CDirEntry()
+bool	CDirEntry::GetHostPath(char *sPath) const
 {
-	if (m_pDirectory)
-		delete m_pDirectory;
-	
+	const char *pDir = m_pParent->GetHostPath();
+	if (NULL == pDir)
+		return false;
+#ifdef _WIN32
+	snprintf(sPath,_MAX_PATH,"%s\\%s",pDir,m_pLongName);
+#else
+	snprintf(sPath,_MAX_PATH,"%s/%s",pDir,m_pLongName);
+#endif
+	return true;
 }
 
-CDirectory::CDirectory()
+CDirectory*	CDirectory::Create(CArena *pArena,const char *pHostPath)
 {
-	m_nbEntry = 0;
-	m_pEntryList = NULL;
+	CDirectory *pDir = pArena->New<CDirectory>();
+	pDir->m_pArena = pArena;
+	pDir->m_pHostPath = pHostPath ? pArena->Intern(pHostPath) : NULL;
+	pDir->m_pEntries = NULL;
+	pDir->m_nbEntry = 0;
+	pDir->m_capacity = 0;
+	return pDir;
 }
 
-CDirectory::~CDirectory()
+// Ascending in the array, so GetEntry() gives them in descending order: the order a NTFS
+// scan used to give (entries were added to the head of a list), whatever the host file system
+void	CDirectory::SortByName()
 {
-	
-	CDirEntry *pEntry = m_pEntryList;
-	while (pEntry)
+	std::sort(m_pEntries,m_pEntries + m_nbEntry,[](const CDirEntry &a,const CDirEntry &b)
+	{
+		int cmp = stricmp(a.GetLongName(),b.GetLongName());
+		if (0 == cmp)
+			cmp = strcmp(a.GetLongName(),b.GetLongName());
+		return cmp < 0;
+	});
+}
+
+CDirEntry*	CDirectory::AddEntry(const FileDescriptor *pInfo,CDirectory *pSubDir,int zipIndex)
+{
+	if (m_nbEntry == m_capacity)
+	{	// the old array stays in the arena
+		m_capacity = m_capacity ? m_capacity * 2 : 8;
+		CDirEntry *pEntries = (CDirEntry*)m_pArena->Alloc(m_capacity * sizeof(CDirEntry),alignof(CDirEntry));
+		if (m_nbEntry)
+			memcpy(pEntries,m_pEntries,m_nbEntry * sizeof(CDirEntry));
+		m_pEntries = pEntries;
+	}
+
+	CDirEntry *pEntry = m_pEntries + m_nbEntry++;
+	pEntry->Create(pInfo,this,pSubDir,zipIndex,m_pArena);
+	return pEntry;
+}
+
+
+//--------------- File sources -------------------------------------------
+
+// Straight to the clusters. Fails if the file size changed since the directory scan
+bool	CHostFileSource::Load(const CDirEntry *pEntry,unsigned char *pDst,int /*worker*/)
+{
+	char sPath[_MAX_PATH];
+	if (!pEntry->GetHostPath(sPath))
+		return false;
+	return HostReadFile( sPath, pDst, pEntry->GetSize() );
+}
+
+void	CHostFileSource::LoadBatch(CDirEntry * const *ppEntry,unsigned char * const *ppDst,char *pLoaded,int nbFile)
+{
+	std::vector<std::string> paths(nbFile);
+	std::vector<HostReadRequest> requests(nbFile);
+	for (int i=0;i<nbFile;i++)
+	{
+		char sPath[_MAX_PATH];
+		if (ppEntry[i]->GetHostPath(sPath))
+			paths[i] = sPath;
+		requests[i].pPath = paths[i].c_str();		// empty: fails, then Load() reports it
+		requests[i].pDst = ppDst[i];
+		requests[i].size = ppEntry[i]->GetSize();
+	}
+
+	if (HostReadFiles(requests.data(),nbFile))
 	{
-		CDirEntry *pTmp = pEntry;
-		pEntry = pEntry->GetNext();
-		delete pTmp;
+		for (int i=0;i<nbFile;i++)
+			pLoaded[i] = requests[i].bOk;
 	}
 }
 
+CZIPFileSource::CZIPFileSource(const char *pZIPName)
+{
+	strcpy( m_sZIPName, pZIPName );
+	m_pZIPData = NULL;
+	m_zipSize = 0;
+	if ( m_map.Open( pZIPName ) && ( m_map.GetSize() <= 0xffffffffu ) )
+	{
+		m_pZIPData = m_map.GetData();
+		m_zipSize = (unsigned long)m_map.GetSize();
+	}
+}
 
-void	CDirEntry::Create(const FileDescriptor *pInfo,CDirectory *pDir,const char *pHostName, ZFILE* pZIP)
+CZIPFileSource::CZIPFileSource(const void *pZIPData,unsigned long size)
 {
-	m_info = *pInfo;
-	m_pDirectory = pDir;
+	m_sZIPName[0] = 0;
+	m_pZIPData = pZIPData;
+	m_zipSize = size;
+}
 
-	if ( pHostName )
+CZIPFileSource::~CZIPFileSource()
+{
+	for (size_t i=0;i<m_handles.size();i++)
 	{
-		strcpy(m_sHostName,pHostName);
-		FILE* h = fopen( m_sHostName, "rb" );
-		if ( h )
-		{
-			m_pFileData = malloc( m_info.nFileSizeLow + 1 );	// +1 to avoid problem with 0 bytes file
-			fread( m_pFileData, 1, m_info.nFileSizeLow, h );
-			fclose( h );
-		}
-		else
-		{
-			printf("FATAL ERROR: Could not load \"%s\"\n", m_info.cFileName );
-		}
+		if ( m_handles[i] )
+			zclose( m_handles[i] );
+	}
+}
+
+ZFILE	*	CZIPFileSource::Open() const
+{
+	return m_pZIPData ? zopenmem( m_pZIPData, m_zipSize ) : zopen( m_sZIPName, "rb" );
+}
+
+void	CZIPFileSource::SetNbWorker(int nbWorker)
+{
+	m_handles.resize( nbWorker, (ZFILE*)NULL );
+	m_compressed.resize( nbWorker, 0 );
+	m_inflated.resize( nbWorker, 0 );
+}
+
+// One handle per worker: a ZFILE isn't shareable, but members are independent streams
+bool	CZIPFileSource::Load(const CDirEntry *pEntry,unsigned char *pDst,int worker)
+{
+	ZFILE* &pHandle = m_handles[ worker ];
+	if ( NULL == pHandle )
+		pHandle = Open();
+
+	if ( NULL == pHandle )
+		return false;
+
+	if ( 0 != zextract( pHandle, pEntry->GetZIPIndex(), pDst, pEntry->GetSize() ) )
+		return false;
+
+	m_compressed[ worker ] += zentry( pHandle, pEntry->GetZIPIndex() )->csiz;
+	m_inflated[ worker ] += pEntry->GetSize();
+	return true;
+}
+
+bool	CMemoryFileSource::Load(const CDirEntry *pEntry,unsigned char *pDst,int /*worker*/)
+{
+	memcpy(pDst,m_ppData[pEntry->GetZIPIndex()],pEntry->GetSize());
+	return true;
+}
+
+void	CZIPFileSource::AddStats(JobStats *pStats) const
+{
+	for (size_t i=0;i<m_handles.size();i++)
+	{
+		pStats->nbZipCompressed += m_compressed[ i ];
+		pStats->nbZipInflated += m_inflated[ i ];
 	}
+}
 
-	if ( pZIP )
+CZIPStreamSource::~CZIPStreamSource()
+{
+	for (size_t i=0;i<m_data.size();i++)
+		free( m_data[i] );
+}
+
+CDirectory	*	CZIPStreamSource::Read(FILE *h,CArena *pArena)
+{
+	ZSTREAM *pStream = zstreamopen( h );
+	if ( NULL == pStream )
+		return NULL;
+
+	m_compressed = 0;
+	m_inflated = 0;
+
+	// names only live till the next member
+	std::vector<std::string> names;
+	std::vector<PathEntry> paths;
+	ZENTRY zEntry;
+	unsigned char *pData;
+	int rCode;
+	while ( 1 == ( rCode = zstreamnext( pStream, &zEntry, &pData ) ) )
 	{
-		zseek( pZIP, 0, SEEK_SET);		// ZLIB bug !! Must seek to 0 before to seek end, error if not !
-		zseek( pZIP, 0, SEEK_END);
-		m_info.nFileSizeLow = ztell( pZIP );
-		zseek( pZIP, 0, SEEK_SET);		// ZLIB bug !! Must seek to 0 before to seek end, error if not !
-		m_pFileData = malloc( m_info.nFileSizeLow + 1 );	// +1 to avoid problem with 0 bytes file
-		zread( m_pFileData, 1, m_info.nFileSizeLow, pZIP );
+		m_data.push_back( pData );
+		names.push_back( zEntry.name );
+
+		PathEntry path;
+		path.size = ( zEntry.usiz > MAX_FILE_SIZE ) ? MAX_FILE_SIZE : (DWORD)zEntry.usiz;
+		DosDateTimeToFileTime( (WORD)zEntry.mdat, (WORD)zEntry.mtim, &path.time );
+		paths.push_back( path );
+
+		m_compressed += zEntry.csiz;
+		m_inflated += zEntry.usiz;
 	}
+	zstreamclose( pStream );
+
+	if ( rCode < 0 )
+		return NULL;
+
+	for (size_t i=0;i<paths.size();i++)
+		paths[i].pPath = names[i].c_str();
+
+	return CreateTreeFromPaths( paths.data(), (int)paths.size(), pArena );
+}
+
+bool	CZIPStreamSource::Load(const CDirEntry *pEntry,unsigned char *pDst,int /*worker*/)
+{
+	memcpy( pDst, m_data[ pEntry->GetZIPIndex() ], pEntry->GetSize() );
+	return true;
 }
 
-void	CDirectory::AddEntry(const FileDescriptor *pInfo,CDirectory *pSubDir,const char *pHostName, ZFILE* pZIP)
+void	CZIPStreamSource::AddStats(JobStats *pStats) const
 {
-	CDirEntry *pEntry = new CDirEntry;
-	pEntry->Create(pInfo,pSubDir,pHostName, pZIP);
-	pEntry->SetNext(m_pEntryList);
-	m_pEntryList = pEntry;
-	m_nbEntry++;
+	pStats->nbZipCompressed += m_compressed;
+	pStats->nbZipInflated += m_inflated;
 }
 
 
-void	DirectoryScan(const char *pDir,CDirectory *pCurrent)
+#ifdef _WIN32
+
+void	DirectoryScan(const char *pDir,CDirectory *pCurrent,CArena *pArena)
 {
 
 	char tmpName[_MAX_PATH];
@@ -189,6 +423,9 @@ void	DirectoryScan(const char *pDir,CDirectory *pCurrent)
 		{
 			if (0 == (info.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN|FILE_ATTRIBUTE_SYSTEM)))
 			{
+				if (info.nFileSizeHigh || (info.nFileSizeLow > MAX_FILE_SIZE))
+					info.nFileSizeLow = MAX_FILE_SIZE;
+
 				strcpy(tmpName,pDir);
 				sprintf(tmpName,"%s\\%s",pDir,info.cFileName);
 
@@ -196,14 +433,14 @@ void	DirectoryScan(const char *pDir,CDirectory *pCurrent)
 				{
 					if ('.' != info.cFileName[0])		// skip original "." and ".." entries on host system
 					{
-						CDirectory *pNewDir = new CDirectory;
-						pCurrent->AddEntry(&info,pNewDir,tmpName);
-						DirectoryScan(tmpName,pNewDir);
+						CDirectory *pNewDir = CDirectory::Create(pArena,tmpName);
+						pCurrent->AddEntry(&info,pNewDir);
+						DirectoryScan(tmpName,pNewDir,pArena);
 					}
 				}
 				else
 				{
-					pCurrent->AddEntry(&info,NULL,tmpName);
+					pCurrent->AddEntry(&info,NULL);
 				}
 			}
 		}
@@ -211,188 +448,173 @@ void	DirectoryScan(const char *pDir,CDirectory *pCurrent)
 
 		FindClose(hSearch);
 	}
+	pCurrent->SortByName();
 }
 
+#else
 
-void	CDirectory::Dump(const char *pPath)
+// POSIX walk: everything is resolved relative to the opened directory (no path
+// lookups from the root), and d_type lets us skip entries we don't care about
+// without a stat. Dot files are the POSIX equivalent of hidden files.
+static	void	DirectoryScanAt(int dirFd,const char *pDir,CDirectory *pCurrent,CArena *pArena)
 {
-
-	char sTmp[_MAX_PATH];
-
-	printf("[%s] ( %d entries )\n",pPath,m_nbEntry);
-
-	CDirEntry *pEntry = m_pEntryList;
-	while (pEntry)
+	DIR *pHostDir = fdopendir(dirFd);
+	if (NULL == pHostDir)
 	{
-		if (pEntry->GetDirectory())
-		{
-			sprintf(sTmp,"%s/%s",pPath,pEntry->GetName());
-			pEntry->GetDirectory()->Dump(sTmp);
-		}
-		pEntry = pEntry->GetNext();
+		close(dirFd);
+		return;
 	}
 
-	pEntry = m_pEntryList;
-	while (pEntry)
+	char tmpName[_MAX_PATH];
+	struct dirent *pDirent;
+	while (NULL != (pDirent = readdir(pHostDir)))
 	{
-		if (!pEntry->GetDirectory())
-		{
-			printf("  %10d : %s\n",pEntry->GetSize(),pEntry->GetName());
-		}
-		pEntry = pEntry->GetNext();
-	}
-
-	printf("\n");
-}
-
-CDirectory	*	CreateTreeFromDirectory(const char *pHostDirName)
-{
+		const char *pName = pDirent->d_name;
+		if ('.' == pName[0])
+			continue;
 
-	CDirectory *pRoot = new CDirectory();
+		unsigned char type = pDirent->d_type;
+		if ((DT_UNKNOWN != type) && (DT_DIR != type) && (DT_REG != type) && (DT_LNK != type))
+			continue;						// fifo, socket, device...
 
-	DirectoryScan(pHostDirName,pRoot);
+		struct stat st;
+		if (0 != fstatat(dirFd,pName,&st,0))
+			continue;
 
-	return pRoot;
-}
-
-
-const char* DirAdvance( const char* pCurrent, char* pOut )
-{
-	for (;;)
-	{
+		FileDescriptor info;
+		memset(&info,0,sizeof(info));
+		snprintf(info.cFileName,sizeof(info.cFileName),"%s",pName);
+		UnixTimeToFileTime(st.st_mtime,&info.ftLastWriteTime);
+		snprintf(tmpName,sizeof(tmpName),"%s/%s",pDir,pName);
 
-		if ( '/' == *pCurrent )
+		if (S_ISDIR(st.st_mode))
 		{
-			*pOut++ = 0;
-			return pCurrent+1;
+			int subFd = openat(dirFd,pName,O_RDONLY|O_DIRECTORY);
+			if (subFd >= 0)
+			{
+				info.dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+				CDirectory *pNewDir = CDirectory::Create(pArena,tmpName);
+				pCurrent->AddEntry(&info,pNewDir);
+				DirectoryScanAt(subFd,tmpName,pNewDir,pArena);
+			}
 		}
-		else
+		else if (S_ISREG(st.st_mode))
 		{
-			*pOut++ = *pCurrent++;
-			if ( pOut[-1] == 0 )
-				return pCurrent-1;
+			info.nFileSizeLow = (st.st_size > (off_t)MAX_FILE_SIZE) ? MAX_FILE_SIZE : (DWORD)st.st_size;
+			pCurrent->AddEntry(&info,NULL);
 		}
 	}
-}
 
+	closedir(pHostDir);				// also closes dirFd
+	pCurrent->SortByName();
+}
 
-CDirectory*	GetFromZIPPath( CDirectory* pRoot, const char* pZIPPath )
+void	DirectoryScan(const char *pDir,CDirectory *pCurrent,CArena *pArena)
 {
-	const char* pParse = pZIPPath;
-	char sDirName[ _MAX_PATH ];
+	int dirFd = open(pDir,O_RDONLY|O_DIRECTORY);
+	if (dirFd >= 0)
+		DirectoryScanAt(dirFd,pDir,pCurrent,pArena);
+}
 
-	CDirectory* pCurrent = pRoot;
+#endif
 
-	for (;;)
-	{
 
-		assert( *pParse );								// if this is the end, we miss the filename
-		pParse = DirAdvance( pParse, sDirName );
+void	CDirectory::Dump(const char *pPath) const
+{
+
+	char sTmp[_MAX_PATH];
 
-		if ( 0 == *pParse )
-			break;					// last name is the filename (not a dir name)
+	printf("[%s] ( %d entries )\n",pPath,m_nbEntry);
 
-		// maybe directory already exist
-		CDirEntry* pEntry = pCurrent->GetFirstEntry();
-		CDirEntry* pFound = NULL;
-		while ( pEntry )
+	for (int i=0;i<m_nbEntry;i++)
+	{
+		const CDirEntry *pEntry = GetEntry(i);
+		if (pEntry->GetDirectory())
 		{
-			if ( pEntry->IsDirectory() )
-			{
-				if ( 0 == stricmp( pEntry->GetName(), sDirName ) )
-				{	// create a new one
-					pFound = pEntry;
-					break;
-				}
-			}
-			pEntry = pEntry->GetNext();
+			sprintf(sTmp,"%s/%s",pPath,pEntry->GetName());
+			pEntry->GetDirectory()->Dump(sTmp);
 		}
+	}
 
-		if ( NULL == pFound )
+	for (int i=0;i<m_nbEntry;i++)
+	{
+		const CDirEntry *pEntry = GetEntry(i);
+		if (!pEntry->GetDirectory())
 		{
-			printf("INTERNAL Error GetFromZIPPath!\nAbort\n" );
-			exit(1);
+			printf("  %10d : %s\n",pEntry->GetSize(),pEntry->GetName());
 		}
-
-		pCurrent = pFound->GetDirectory();
-
 	}
-	return pCurrent;
-}
 
+	printf("\n");
+}
 
-void	CreateDirPath( CDirectory* pRoot, const char* sZIPPath )
+CDirectory	*	CreateTreeFromDirectory(const char *pHostDirName,CArena *pArena)
 {
 
-	const char* pParse = sZIPPath;
-	char sDirName[ _MAX_PATH ];
+	CDirectory *pRoot = CDirectory::Create(pArena,pHostDirName);
 
-	CDirectory* pCurrent = pRoot;
+	DirectoryScan(pHostDirName,pRoot,pArena);
 
-	while ( *pParse )
-	{
-		pParse = DirAdvance( pParse, sDirName );
+	return pRoot;
+}
 
-		// maybe directory already exist
-		CDirEntry* pEntry = pCurrent->GetFirstEntry();
-		CDirEntry* pFound = NULL;
-		while ( pEntry )
-		{
-			if ( pEntry->IsDirectory() )
-			{
-				if ( 0 == stricmp( pEntry->GetName(), sDirName ) )
-				{	// create a new one
-					pFound = pEntry;
-					break;
-				}
-			}
-			pEntry = pEntry->GetNext();
-		}
 
-		if ( NULL == pFound )
-		{
-			FileDescriptor oFDesc;
-			memset( &oFDesc, 0, sizeof( oFDesc ) );
+// ZIP directories by full path ("A/B/", upper case: names are case insensitive)
+typedef	std::unordered_map<std::string,CDirectory*>	ZIPDirMap;
 
-			strncpy( oFDesc.cFileName, sDirName, 13 );
+// Directory of the first len chars of a member path (up to and including its '/'),
+// missing parents are created: members may come before their directory entry
+static	CDirectory*	GetZIPDirectory( ZIPDirMap& dirs, CDirectory* pRoot, const char* pPath, int len, CArena* pArena )
+{
+	if ( 0 == len )
+		return pRoot;
 
-			CDirectory *pNewDir = new CDirectory;
+	std::string key( pPath, len );
+	for (size_t i=0;i<key.size();i++)
+		key[i] = (char)toupper( (unsigned char)key[i] );
 
-			pCurrent->AddEntry( &oFDesc, pNewDir, NULL );
+	ZIPDirMap::const_iterator it = dirs.find( key );
+	if ( it != dirs.end() )
+		return it->second;
 
-			pCurrent = pNewDir;
+	int parentLen = len - 1;
+	while ( ( parentLen > 0 ) && ( '/' != pPath[ parentLen-1 ] ) )
+		parentLen--;
 
-		}
-		else
-			pCurrent = pFound->GetDirectory();
+	CDirectory* pParent = GetZIPDirectory( dirs, pRoot, pPath, parentLen, pArena );
 
-	}
+	FileDescriptor oFDesc;
+	memset( &oFDesc, 0, sizeof( oFDesc ) );
+	int nameLen = len - 1 - parentLen;
+	strncpy( oFDesc.cFileName, pPath + parentLen, ( nameLen < 13 ) ? nameLen : 13 );
 
+	CDirectory *pNewDir = CDirectory::Create( pArena, NULL );
+	pParent->AddEntry( &oFDesc, pNewDir );
+	dirs[ key ] = pNewDir;
+	return pNewDir;
 }
 
 
-CDirectory* CreateTreeFromZIP( const char *pHostDirName, ZFILE* pFile )
+CDirectory* CreateTreeFromPaths( const PathEntry* pEntries, int nbEntry, CArena* pArena )
 {
-	CDirectory *pRoot = new CDirectory();
-
+	CDirectory *pRoot = CDirectory::Create( pArena, NULL );
+	ZIPDirMap dirs;
 
-	for (;;)
+	for (int i=0;i<nbEntry;i++)
 	{
-		const char* pPath = zname( pFile );
-		if ( NULL == pPath )
-			break;
+		const char* pPath = pEntries[i].pPath;
 
 		int iLen = strlen( pPath );
 		if ( iLen > 0)
 		{
 			if ( '/' == pPath[ iLen-1 ] )
 			{	// new directory
-				// create complete path from root
-				CreateDirPath( pRoot, pPath );
+				GetZIPDirectory( dirs, pRoot, pPath, iLen, pArena );
 			}
 			else
 			{	// supposed to be a file
-				CDirectory* pDir = GetFromZIPPath( pRoot, pPath );
+				const char* pName = strrchr( pPath, '/' );
+				CDirectory* pDir = GetZIPDirectory( dirs, pRoot, pPath, pName ? (int)( pName + 1 - pPath ) : 0, pArena );
 
 				FileDescriptor oFDesc;
 				memset( &oFDesc, 0, sizeof( oFDesc ) );
@@ -400,20 +622,41 @@ CDirectory* CreateTreeFromZIP( const char *pHostDirName, ZFILE* pFile )
 				char sFilename[ _MAX_FNAME ];
 				char sExt[ _MAX_EXT ];
 				_splitpath( pPath, NULL, NULL, sFilename, sExt );
-				sprintf( oFDesc.cFileName, "%s%s", sFilename, sExt );
-
-				pDir->AddEntry( &oFDesc, NULL, NULL, pFile );
+				if ( (size_t)snprintf( oFDesc.cFileName, sizeof( oFDesc.cFileName ), "%s%s", sFilename, sExt ) >= sizeof( oFDesc.cFileName ) )
+				{
+					printf( "WARNING: \"%s\" skipped, its name is too long\n", pPath );
+					continue;
+				}
+				oFDesc.nFileSizeLow = ( pEntries[i].size > MAX_FILE_SIZE ) ? MAX_FILE_SIZE : pEntries[i].size;
+				oFDesc.ftLastWriteTime = pEntries[i].time;
 
+				pDir->AddEntry( &oFDesc, NULL, i );
 			}
 		}
-
-		znext( pFile );
 	}
 
-
 	return pRoot;
 }
 
+// Build the tree from the ZIP index only: member data is extracted later, straight to the image
+CDirectory* CreateTreeFromZIP( ZFILE* pFile, CArena* pArena )
+{
+	int nbFile = zcount( pFile );
+	if ( nbFile < 0 )
+		return NULL;
+
+	std::vector<PathEntry> paths( nbFile );
+	for (int i=0;i<nbFile;i++)
+	{
+		const ZENTRY *pZEntry = zentry( pFile, i );
+		paths[i].pPath = pZEntry->name;
+		paths[i].size = ( pZEntry->usiz > MAX_FILE_SIZE ) ? MAX_FILE_SIZE : (DWORD)pZEntry->usiz;
+		DosDateTimeToFileTime( (WORD)pZEntry->mdat, (WORD)pZEntry->mtim, &paths[i].time );
+	}
+
+	return CreateTreeFromPaths( paths.data(), nbFile, pArena );
+}
+
 
 static unsigned short SWAP16(unsigned short d)
 {
@@ -421,119 +664,265 @@ static unsigned short SWAP16(unsigned short d)
 }
 
 
-static	int		ComputeRLE(unsigned char *p,unsigned char data,int todo)
+static	const	int		TRACK_PER_JOB		=	8;
+
+// Pack a track to its slot, or copy it from the previous build if its content did not change
+static	int		PackTrack(const unsigned char *pTrack,int t,int rawSize,unsigned char *pSlot,const CCacheEntry *pPrevious,HASH64 *pHash)
 {
-	int nb = 0;
-	while ((todo > 0) && (*p == data))
+	if (pHash)
 	{
-		nb++;
-		todo--;
-		p++;
+		*pHash = HashBlock(pTrack,rawSize);
+		int size;
+		const unsigned char *pPacked = pPrevious ? pPrevious->FindTrack(t,rawSize,*pHash,&size) : NULL;
+		if (pPacked)
+		{
+			memcpy(pSlot,pPacked,size);
+			return size;
+		}
 	}
-	return nb;
+	return MsaPackTrack(pTrack,rawSize,pSlot);
 }
 
-bool	CFloppy::WriteImage(const char *pName)
+// Every written track is packed in its own slot (in parallel when there is a pool),
+// then the slots are made contiguous, with the blank tracks in between
+int		CFloppy::PackMSA(CThreadPool *pPool,const CCacheEntry *pPrevious,CCacheEntry *pResult)
 {
-	FILE *h = fopen(pName,"wb");
-	if (h)
-	{
+	FAT_Flush();
 
-		FAT_Flush();
-
-		MSAHEADER header;
-		header.ID = 0x0f0e;
-		header.StartTrack = 0;
-		header.EndTrack = SWAP16(m_nbCylinder-1);
-		header.Sectors = SWAP16(m_nbSectorPerTrack);
-		header.Sides = SWAP16(m_nbSide-1);
-		fwrite(&header,1,sizeof(header),h);
+	int nbTrack = m_nbCylinder * m_nbSide;
+	int rawSize = m_nbSectorPerTrack * 512;
+	int slotSize = MsaTrackSlotSize(rawSize);
+	int msaSize = (int)sizeof(MSAHEADER) + nbTrack * slotSize;
+	if (msaSize > m_msaCapacity)
+	{
+		delete [] m_pMsaImage;
+		m_pMsaImage = new unsigned char [msaSize];
+		m_msaCapacity = msaSize;
+	}
 
-		unsigned char *pTempBuffer = new unsigned char [32*1024];
+	MSAHEADER header;
+	header.ID = 0x0f0e;
+	header.StartTrack = 0;
+	header.EndTrack = SWAP16(m_nbCylinder-1);
+	header.Sectors = SWAP16(m_nbSectorPerTrack);
+	header.Sides = SWAP16(m_nbSide-1);
+	memcpy(m_pMsaImage,&header,sizeof(header));
+
+	unsigned char *pSlots = m_pMsaImage + sizeof(header);
+	std::vector<int> packedSize(nbTrack);
+	std::vector<HASH64> hashes(nbTrack,0);
+	std::vector<int> dirtyTracks;
+	for (int t=0;t<nbTrack;t++)
+	{
+		if (m_trackDirty[t])
+			dirtyTracks.push_back(t);
+	}
 
-		int rawSize = m_nbSectorPerTrack * 512;
+	const unsigned char *pRaw = m_pRawImage;
+	const int *pDirty = dirtyTracks.data();
+	int *pPackedSize = packedSize.data();
+	HASH64 *pHashes = (pPrevious || pResult) ? hashes.data() : NULL;
+	int nbDirty = (int)dirtyTracks.size();
 
-		for (int t=0;t<m_nbCylinder * m_nbSide;t++)
+	if (pPool)
+	{
+		CJobGroup packs;
+		for (int first=0;first<nbDirty;first+=TRACK_PER_JOB)
 		{
-			unsigned char *pR = (unsigned char*)m_pRawImage + t * rawSize;
-			unsigned char *pTemp = pTempBuffer;
-			int todo = rawSize;
-			
-			while (todo > 0)
+			int last = std::min(first + TRACK_PER_JOB,nbDirty);
+			pPool->Submit([=]
 			{
-				unsigned char data = *pR;
-				int nRepeat = ComputeRLE(pR,data,todo);
-				if ((nRepeat > 4) || (0xe5 == data))
-				{	// RLE efficient (or 0xe5 special case)
-					*pTemp++ = 0xe5;
-					*pTemp++ = data;
-					*pTemp++ = (nRepeat>>8)&255;
-					*pTemp++ = (nRepeat&255);
-					todo -= nRepeat;
-					pR += nRepeat;
-				}
-				else
+				for (int i=first;i<last;i++)
 				{
-					*pTemp++ = data;
-					todo--;
-					pR++;
+					int t = pDirty[i];
+					pPackedSize[t] = PackTrack(pRaw + t * rawSize,t,rawSize,pSlots + t * slotSize,pPrevious,pHashes ? pHashes + t : NULL);
 				}
-			}
-			
-			// check if packing track was efficient
-			int packedSize = ((int)pTemp - (int)pTempBuffer);
-			if (packedSize < rawSize)
-			{
-				fputc(packedSize>>8,h);
-				fputc(packedSize&255,h);
-				fwrite(pTempBuffer,1,packedSize,h);
-			}
-			else
-			{
-				fputc(rawSize>>8,h);
-				fputc(rawSize&255,h);
-				fwrite((unsigned char*)m_pRawImage + t * rawSize,1,rawSize,h);
-			}
-			
+			},&packs);
+		}
+		pPool->Wait(&packs);
+	}
+	else
+	{
+		for (int i=0;i<nbDirty;i++)
+		{
+			int t = pDirty[i];
+			pPackedSize[t] = PackTrack(pRaw + t * rawSize,t,rawSize,pSlots + t * slotSize,pPrevious,pHashes ? pHashes + t : NULL);
+		}
+	}
+
+	// slot t never moves before the end of track t-1, so slots can be packed in place
+	// (a blank track record is smaller than a slot: it doesn't reach slot t+1 either)
+	unsigned char *pOut = pSlots;
+	if (pResult)
+		pResult->m_tracks.resize(nbTrack);
+	if (m_pStats)
+	{
+		m_pStats->trackRawSize = rawSize;
+		m_pStats->trackPackedSize.resize(nbTrack);
+	}
+	for (int t=0;t<nbTrack;t++)
+	{
+		unsigned char *pTrack = pOut;
+		if (pResult)
+		{
+			pResult->m_tracks[t].hash = hashes[t];
+			pResult->m_tracks[t].offset = (int)(pOut - m_pMsaImage);
+		}
+
+		if (!m_trackDirty[t])
+			pOut += MsaPackBlankTrack(rawSize,pOut);
+		else
+		{
+			if (pOut != pSlots + t * slotSize)
+				memmove(pOut,pSlots + t * slotSize,packedSize[t]);
+			pOut += packedSize[t];
 		}
 
-		delete [] pTempBuffer;
+		if (pResult)
+			pResult->m_tracks[t].size = (int)(pOut - m_pMsaImage) - pResult->m_tracks[t].offset;
+		if (m_pStats)
+			m_pStats->trackPackedSize[t] = (int)(pOut - pTrack);
+	}
 
-		return true;
+	if (pResult)
+	{
+		pResult->m_rawSize = rawSize;
+		pResult->m_msa.assign(m_pMsaImage,pOut);
 	}
-	return false;
+	return (int)(pOut - m_pMsaImage);
 }
 
+bool	CFloppy::WriteMSA(const char *pName,CThreadPool *pPool,const CCacheEntry *pPrevious,CCacheEntry *pResult)
+{
+	size_t size = PackMSA(pPool,pPrevious,pResult);
 
+	FILE *h = fopen(pName,"wb");
+	if (h)
+	{
+		bool bOk = (size == fwrite(m_pMsaImage,1,size,h));
+		return (0 == fclose(h)) && bOk;
+	}
+	return false;
+}
 
+// Tracks that were never written are only 0xe5 in the copy: the image buffer
+// itself is not even initialized there
+void	CFloppy::CopyST(unsigned char *pDst)
+{
+	FAT_Flush();
 
+	int nbTrack = m_nbCylinder * m_nbSide;
+	int rawSize = m_nbSectorPerTrack * 512;
+	for (int t=0;t<nbTrack;t++)
+	{
+		if (m_trackDirty[t])
+			memcpy(pDst + t * rawSize,m_pRawImage + t * rawSize,rawSize);
+		else
+			memset(pDst + t * rawSize,0xe5,rawSize);
+	}
+}
 
-static	void	LFNStrCpy(char *pDst,const char *pSrc,int len)
+bool	CFloppy::WriteST(const char *pName)
 {
-	for (int i=0;i<len;i++)
+	CMappedOutput out;
+	if (out.Create(pName,m_rawSize))
 	{
-		if ((*pSrc) && (*pSrc != '.'))
+		CopyST(out.GetData());
+		return out.Close();
+	}
+
+	FAT_Flush();
+
+	int nbTrack = m_nbCylinder * m_nbSide;
+	int rawSize = m_nbSectorPerTrack * 512;
+
+	// no mapping: write runs of tracks straight from the image buffer
+	FILE *h = fopen(pName,"wb");
+	if (NULL == h)
+		return false;
+
+	std::vector<unsigned char> blank(rawSize,0xe5);
+	bool bOk = true;
+	for (int t=0;(t<nbTrack) && bOk;)
+	{
+		int last = t + 1;
+		if (m_trackDirty[t])
 		{
-			*pDst++ = *pSrc++;
+			while ((last < nbTrack) && m_trackDirty[last])
+				last++;
+			size_t size = (size_t)(last - t) * rawSize;
+			bOk = (size == fwrite(m_pRawImage + t * rawSize,1,size,h));
 		}
 		else
-			*pDst++ = 0x20;
+			bOk = (blank.size() == fwrite(blank.data(),1,blank.size(),h));
+		t = last;
 	}
+	return (0 == fclose(h)) && bOk;
 }
 
-void	CDirEntry::LFN_Create(LFN *pLFN,int clusterStart)
-{
-	memset(pLFN,0,sizeof(LFN));
-	char sFname[_MAX_FNAME];
-	char sExt[_MAX_FNAME];
 
-	_splitpath(GetName(),NULL,NULL,sFname,sExt);
-	strupr(sFname);
-	strupr(sExt);
+//--------------- Image writers ------------------------------------------
 
-	char *pExt = sExt;
-	if ('.' == *pExt)
-		pExt++;
+ImageFormat		ImageFormatFromName(const char *pName)
+{
+	const char *pExt = strrchr(pName,'.');
+	if (pExt && (NULL == strpbrk(pExt,"/\\")) && (0 == stricmp(pExt,".st")))
+		return IMAGE_FORMAT_ST;
+	return IMAGE_FORMAT_MSA;
+}
+
+const char	*	ImageFormatExtension(ImageFormat format)
+{
+	return (IMAGE_FORMAT_ST == format) ? ".st" : ".msa";
+}
+
+CImageWriter*	CImageWriter::Create(ImageFormat format)
+{
+	if (IMAGE_FORMAT_ST == format)
+		return new CStWriter;
+	return new CMsaWriter;
+}
+
+bool	CMsaWriter::Write(CFloppy &floppy,const char *pName,CThreadPool *pPool)
+{
+	return floppy.WriteMSA(pName,pPool,m_pPrevious,m_pResult);
+}
+
+bool	CStWriter::Write(CFloppy &floppy,const char *pName,CThreadPool * /*pPool*/)
+{
+	return floppy.WriteST(pName);
+}
+
+
+
+
+
+static	void	LFNStrCpy(char *pDst,const char *pSrc,int len)
+{
+	for (int i=0;i<len;i++)
+	{
+		if ((*pSrc) && (*pSrc != '.'))
+		{
+			*pDst++ = *pSrc++;
+		}
+		else
+			*pDst++ = 0x20;
+	}
+}
+
+void	CDirEntry::LFN_Create(LFN *pLFN,int clusterStart,const FILETIME *pMaxTime) const
+{
+	memset(pLFN,0,sizeof(LFN));
+	char sFname[_MAX_FNAME];
+	char sExt[_MAX_FNAME];
+
+	_splitpath(GetName(),NULL,NULL,sFname,sExt);
+	strupr(sFname);
+	strupr(sExt);
+
+	char *pExt = sExt;
+	if ('.' == *pExt)
+		pExt++;
 
 	LFNStrCpy(pLFN->sName,sFname,8);
 	LFNStrCpy(pLFN->sExt,pExt,3);
@@ -546,16 +935,189 @@ void	CDirEntry::LFN_Create(LFN *pLFN,int clusterStart)
 	if (!IsDirectory())
 		pLFN->fileSize = GetSize();
 
-	FileTimeToDosDateTime(&m_info.ftLastWriteTime,&pLFN->updateDate,&pLFN->updateTime);
+	const FILETIME *pTime = &m_time;
+	if (pMaxTime && (CompareFileTime(pTime,pMaxTime) > 0))
+		pTime = pMaxTime;
+	FileTimeToDosDateTime(pTime,&pLFN->updateDate,&pLFN->updateTime);
 
 }
 
 unsigned char	*	CFloppy::GetRawAd(int cluster)
 {
-	return m_pRawImage + 512 * (1+SECTOR_PER_FAT*2+ROOTDIR_NBSECTOR) + 1024*(cluster-2);		// always two reserved clusters
+	return m_pRawImage + 512 * (1+m_sectorPerFat*2+m_nbRootSector) + 1024*(cluster-2);		// always two reserved clusters
+}
+
+// Must be called before writing to the raw image: the first time a track is touched
+// it is filled with 0xe5, and marked to be written by WriteMSA / WriteST
+unsigned char	*	CFloppy::TouchRaw(unsigned char *p,int size)
+{
+	int trackSize = m_nbSectorPerTrack * 512;
+	int offset = (int)(p - m_pRawImage);
+	for (int t=offset/trackSize;t<=(offset+size-1)/trackSize;t++)
+	{
+		if (!m_trackDirty[t])
+		{
+			memset(m_pRawImage + t * trackSize,0xe5,trackSize);
+			m_trackDirty[t] = 1;
+		}
+	}
+	return p;
 }
 
-bool	CFloppy::BuildDirectory(LFN *pLFN,CDirectory *pDir,int cluster,int parentCluster,int size,int level)
+static	void	CollectFiles(CDirectory *pDir,std::vector<CDirEntry*> &files)
+{
+	for (int i=0;i<pDir->GetNbEntry();i++)
+	{
+		CDirEntry *pEntry = pDir->GetEntry(i);
+		if (pEntry->IsDirectory())
+			CollectFiles(pEntry->GetDirectory(),files);
+		else if (pEntry->GetSize() > 0)
+			files.push_back(pEntry);
+	}
+}
+
+static	int		DirNbCluster(const CDirectory *pDir)
+{
+	return (((pDir->GetNbEntry()+2)*32)+1023)/1024;		// nbentry+2 because of "." and ".." directory
+}
+
+static	int		FileNbCluster(const CDirEntry *pEntry)
+{
+	return (pEntry->GetSize()+1023)/1024;
+}
+
+// Contiguous clusters, chained in the FAT. The first nbSkip ones are left free
+// (to start on a track). Returns the first cluster, 0 for no cluster, -1 if no space
+int		CFloppy::AllocClusters(int nbCluster,int nbSkip)
+{
+	if (nbSkip + nbCluster > m_nbFreeCluster)
+	{
+		if (m_verbosity >= VERBOSE_NORMAL)
+			printf("ERROR: No more space on the disk.\n");
+		return -1;
+	}
+	if (0 == nbCluster)
+		return 0;
+
+	m_nextCluster += nbSkip;
+	m_nbFreeCluster -= nbSkip;
+
+	int first = m_nextCluster;
+	for (int i=0;i<nbCluster-1;i++)
+		m_pFat[first+i] = first+i+1;
+
+	m_pFat[first+nbCluster-1] = -1;		// end chain marker
+
+	m_nextCluster += nbCluster;
+	m_nbFreeCluster -= nbCluster;
+	return first;
+}
+
+// Original layout: depth first, each directory followed by its content
+bool	CFloppy::AllocTree(CDirectory *pDir)
+{
+	for (int n=0;n<pDir->GetNbEntry();n++)
+	{
+		CDirEntry *pEntry = pDir->GetEntry(n);
+		CDirectory *pSubDir = pEntry->GetDirectory();
+		int cluster = AllocClusters(pSubDir ? DirNbCluster(pSubDir) : FileNbCluster(pEntry));
+		if (cluster < 0)
+			return false;
+		pEntry->SetFirstCluster(cluster);		// file content is loaded by LoadFiles()
+		if (pSubDir && !AllocTree(pSubDir))
+			return false;
+	}
+	return true;
+}
+
+// Every directory, packed right after the root one
+bool	CFloppy::AllocDirectories(CDirectory *pDir)
+{
+	for (int n=0;n<pDir->GetNbEntry();n++)
+	{
+		CDirEntry *pEntry = pDir->GetEntry(n);
+		CDirectory *pSubDir = pEntry->GetDirectory();
+		if (pSubDir)
+		{
+			int cluster = AllocClusters(DirNbCluster(pSubDir));
+			if (cluster < 0)
+				return false;
+			pEntry->SetFirstCluster(cluster);
+			if (!AllocDirectories(pSubDir))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Free clusters to skip so the file crosses fewer track boundaries, if that's
+// still possible with nbSpare clusters to lose
+int		CFloppy::TrackAlignSkip(int nbCluster,int nbSpare) const
+{
+	int bestSkip = 0;
+	int bestTrack = 0x7fffffff;
+	for (int skip=0;(skip <= nbSpare) && (skip <= (m_nbSectorPerTrack+1)/2);skip++)
+	{
+		int first = ClusterSector(m_nextCluster + skip);
+		int nbTrack = (first + nbCluster*2 - 1) / m_nbSectorPerTrack - first / m_nbSectorPerTrack;
+		if (nbTrack < bestTrack)
+		{
+			bestTrack = nbTrack;
+			bestSkip = skip;
+		}
+	}
+	return bestSkip;
+}
+
+// Directories first, then files in access order, each one contiguous
+bool	CFloppy::AllocInOrder(CDirectory *pRoot,const std::vector<CDirEntry*> &files)
+{
+	if (!AllocDirectories(pRoot))
+		return false;
+
+	long long nbNeeded = 0;
+	for (size_t i=0;i<files.size();i++)
+		nbNeeded += FileNbCluster(files[i]);
+
+	for (size_t i=0;i<files.size();i++)
+	{
+		int nbCluster = FileNbCluster(files[i]);
+		nbNeeded -= nbCluster;
+		long long nbSpare = m_nbFreeCluster - nbNeeded - nbCluster;
+		int nbSkip = (nbSpare > 0) ? TrackAlignSkip(nbCluster,(int)((nbSpare < m_nbSectorPerTrack) ? nbSpare : m_nbSectorPerTrack)) : 0;
+		int cluster = AllocClusters(nbCluster,nbSkip);
+		if (cluster < 0)
+			return false;
+		files[i]->SetFirstCluster(cluster);
+	}
+	return true;
+}
+
+// Head seeks to read the files in that order, from cylinder 0 (directories and FAT
+// are read first). Stepping to the next cylinder is not a seek, but every cylinder
+// crossed is counted in *pDistance
+int		CFloppy::EstimateSeeks(const std::vector<CDirEntry*> &files,int *pDistance) const
+{
+	int sectorPerCylinder = m_nbSectorPerTrack * m_nbSide;
+	int nbSeek = 0;
+	int distance = 0;
+	int cylinder = 0;
+	for (size_t i=0;i<files.size();i++)
+	{
+		int first = ClusterSector(files[i]->GetFirstCluster());
+		int firstCylinder = first / sectorPerCylinder;
+		int lastCylinder = (first + FileNbCluster(files[i])*2 - 1) / sectorPerCylinder;
+		if ((firstCylinder != cylinder) && (firstCylinder != cylinder + 1))
+			nbSeek++;
+		distance += abs(firstCylinder - cylinder) + (lastCylinder - firstCylinder);
+		cylinder = lastCylinder;
+	}
+	*pDistance = distance;
+	return nbSeek;
+}
+
+// Directory entries, clusters are already allocated
+void	CFloppy::BuildDirectory(LFN *pLFN,CDirectory *pDir,int cluster,int parentCluster,int size,int level)
 {
 
 	// clear the directory file
@@ -589,86 +1151,30 @@ bool	CFloppy::BuildDirectory(LFN *pLFN,CDirectory *pDir,int cluster,int parentCl
 		pLFN++;
 	}
 
-	CDirEntry *pEntry = pDir->GetFirstEntry();
-	while (pEntry)
+	for (int n=0;n<pDir->GetNbEntry();n++)
 	{
-		for (int i=0;i<level;i++)
-			printf("  ");
+		CDirEntry *pEntry = pDir->GetEntry(n);
+
+		// 0 byte files use "0" as first cluster
+		pEntry->LFN_Create(pLFN,pEntry->GetFirstCluster(),m_bMaxFileTime ? &m_maxFileTime : NULL);
 
 		CDirectory *pSubDir = pEntry->GetDirectory();			
 		if (pSubDir)
 		{
-			printf("[%s]\n",pEntry->GetName());
-			// reserve space for directory
-			int nbCluster = (((pSubDir->GetNbEntry()+2)*32)+1023)/1024;		// nbentry+2 because of "." and ".." directory
-
-			if (nbCluster > m_nbFreeCluster)
-			{
-				printf("ERROR: No more space on the disk.\n");
-				return false;
-			}
-
-			int SubDirCluster = m_nextCluster;
-
-			pEntry->LFN_Create(pLFN,SubDirCluster);
-
-			for (int i=0;i<nbCluster-1;i++)
-				m_pFat[SubDirCluster+i] = SubDirCluster+i+1;
-
-			m_pFat[SubDirCluster+nbCluster-1] = -1;		// end chain marker
-
-			m_nextCluster += nbCluster;
-			m_nbFreeCluster -= nbCluster;
-
-			if (!BuildDirectory((LFN*)GetRawAd(SubDirCluster),pSubDir,SubDirCluster,cluster,nbCluster*1024,level+1))
-				return false;
-
+			if (m_verbosity >= VERBOSE_ENTRIES)
+				printf("%*s[%s]\n",level*2,"",pEntry->GetName());
+			int SubDirCluster = pEntry->GetFirstCluster();
+			int nbCluster = DirNbCluster(pSubDir);
+			BuildDirectory((LFN*)TouchRaw(GetRawAd(SubDirCluster),nbCluster*1024),pSubDir,SubDirCluster,cluster,nbCluster*1024,level+1);
 		}
 		else
 		{
-			printf("%s\n",pEntry->GetName());
-			// create file entry
-			int nbCluster = (pEntry->GetSize()+1023)/1024;
-
-			if (nbCluster > 0)
-			{
-				if (nbCluster > m_nbFreeCluster)
-				{
-					printf("ERROR: No more space on the disk.\n");
-					return false;
-				}
-
-				int fileCluster = m_nextCluster;
-				pEntry->LFN_Create(pLFN,fileCluster);
-
-				if ( pEntry->GetSize() >= 0 )
-				{
-					memcpy( GetRawAd(fileCluster), pEntry->m_pFileData, pEntry->GetSize() );
-				}
-				else
-				{
-					printf("ERROR: Could not load host file \"%s\"",pEntry->GetHostName());
-					return false;
-				}
-
-				for (int i=0;i<nbCluster-1;i++)
-					m_pFat[fileCluster+i] = fileCluster+i+1;
-
-				m_pFat[fileCluster+nbCluster-1] = -1;		// end chain marker
-			}
-			else
-			{	// special case for 0 bytes files !!
-				pEntry->LFN_Create(pLFN,0);				// 0 byte file use "0" as first cluster
-			}
-			m_nextCluster += nbCluster;
-			m_nbFreeCluster -= nbCluster;
-
+			if (m_verbosity >= VERBOSE_ENTRIES)
+				printf("%*s%s\n",level*2,"",pEntry->GetName());
 		}
 
 		pLFN++;
-		pEntry = pEntry->GetNext();
 	}
-	return true;
 }
 
 
@@ -676,8 +1182,8 @@ void	CFloppy::FAT_Flush()
 {
 
 
-	unsigned char *pFat = m_pRawImage + 512;
-	memset(pFat,0,SECTOR_PER_FAT*512);
+	unsigned char *pFat = TouchRaw(m_pRawImage + 512,m_sectorPerFat*2*512);
+	memset(pFat,0,m_sectorPerFat*512);
 
 	pFat[0] = 0xf7;
 	pFat[1] = 0xff;
@@ -701,29 +1207,126 @@ void	CFloppy::FAT_Flush()
 	}
 
 	// duplicate second fat
-	memcpy(pFat + SECTOR_PER_FAT*512,pFat,SECTOR_PER_FAT*512);
+	memcpy(pFat + m_sectorPerFat*512,pFat,m_sectorPerFat*512);
 
 }
 
-bool	CFloppy::Fill(CDirectory *pRoot)
+// pOrder: files to place first, in that order (the other ones follow in directory
+// order). NULL keeps the original interleaved layout
+bool	CFloppy::Fill(CDirectory *pRoot,const std::vector<CDirEntry*> *pOrder)
 {
 
-	if ((pRoot->GetNbEntry()+1) > MAX_ROOT_ENTRY)
+	if ((pRoot->GetNbEntry()+1) > m_nbRootEntry)
 	{
-		printf("ERROR: Too much files in root directory (%d > %d)\n",pRoot->GetNbEntry(),MAX_ROOT_ENTRY);
+		if (m_verbosity >= VERBOSE_NORMAL)
+			printf("ERROR: Too much files in root directory (%d > %d)\n",pRoot->GetNbEntry(),m_nbRootEntry);
 		return false;
 	}
 
-	LFN *pLFN = (LFN*)(m_pRawImage + 512 * (1+2*SECTOR_PER_FAT));
+	m_pRoot = pRoot;
+
+	// access order: the given files, then the others
+	std::vector<CDirEntry*> files;
+	CollectFiles(pRoot,files);
+	if (pOrder)
+	{
+		std::vector<CDirEntry*> others;
+		others.swap(files);
+		files = *pOrder;
+		std::vector<CDirEntry*> placed(*pOrder);
+		std::sort(placed.begin(),placed.end());
+		for (size_t i=0;i<others.size();i++)
+		{
+			if (!std::binary_search(placed.begin(),placed.end(),others[i]))
+				files.push_back(others[i]);
+		}
+		if (!AllocInOrder(pRoot,files))
+			return false;
+	}
+	else if (!AllocTree(pRoot))
+		return false;
+
+	LFN *pLFN = (LFN*)TouchRaw(m_pRawImage + 512 * (1+2*m_sectorPerFat),m_nbRootSector * 512);
 
 	// Root dir is special: there is a reserved space after boot and fats
-	if (BuildDirectory(pLFN,pRoot,0,0,ROOTDIR_NBSECTOR * 512,0))
+	BuildDirectory(pLFN,pRoot,0,0,m_nbRootSector * 512,0);
+
+	m_nbSeek = EstimateSeeks(files,&m_seekDistance);
+	if (m_pStats)
+	{
+		m_pStats->nbClusterUsed = 0;
+		for (int i=2;i<m_maxFatEntry;i++)
+		{
+			if (m_pFat[i])
+				m_pStats->nbClusterUsed++;
+		}
+		m_pStats->nbClusterFree = m_maxFatEntry - 2 - m_pStats->nbClusterUsed;		// skipped ones included
+		m_pStats->nbSlackByte = 0;
+		for (size_t i=0;i<files.size();i++)
+			m_pStats->nbSlackByte += FileNbCluster(files[i]) * 1024 - files[i]->GetSize();
+	}
+	if (m_verbosity >= VERBOSE_NORMAL)
 	{
 		printf("Free data cluster: %d\n",m_nbFreeCluster);
-		return true;
+		printf("Estimated head seeks: %d (%d cylinders)\n",m_nbSeek,m_seekDistance);
+	}
+	return true;
+}
+
+// Load every file content straight to its clusters (allocated contiguously by Fill)
+bool	CFloppy::LoadFiles(CFileSource *pSource,CThreadPool *pPool)
+{
+	std::vector<CDirEntry*> files;
+	CollectFiles(m_pRoot,files);
+
+	// biggest first, so the longest one doesn't start last
+	std::stable_sort(files.begin(),files.end(),[](CDirEntry *a,CDirEntry *b) { return a->GetSize() > b->GetSize(); });
+
+	std::vector<char> loaded(files.size(),0);
+	std::vector<unsigned char*> dst(files.size());
+	for (size_t i=0;i<files.size();i++)
+		dst[i] = TouchRaw(GetRawAd(files[i]->GetFirstCluster()),files[i]->GetSize());		// before the loads start: tracks are shared
+
+	if (!files.empty())
+		pSource->LoadBatch(files.data(),dst.data(),loaded.data(),(int)files.size());
+
+	CThreadPool *pLoader = pPool ? pPool : new CThreadPool;
+	pSource->SetNbWorker(pLoader->GetNbThread());
+
+	CJobGroup loads;
+	for (size_t i=0;i<files.size();i++)
+	{
+		if (loaded[i])
+			continue;
+		CDirEntry *pEntry = files[i];
+		unsigned char *pDst = dst[i];
+		char *pLoaded = &loaded[i];
+		pLoader->Submit([pLoader,pSource,pEntry,pDst,pLoaded]
+		{
+			*pLoaded = pSource->Load(pEntry,pDst,pLoader->GetWorkerIndex());
+		},&loads);
 	}
+	pLoader->Wait(&loads);
 
-	return false;
+	if (pLoader != pPool)
+		delete pLoader;
+
+	bool bOk = true;
+	for (size_t i=0;i<files.size();i++)
+	{
+		if (loaded[i] && m_pStats)
+		{
+			m_pStats->nbFileRead++;
+			m_pStats->nbByteRead += files[i]->GetSize();
+		}
+		if (!loaded[i])
+		{
+			if (m_verbosity >= VERBOSE_NORMAL)
+				printf("ERROR: Could not load file \"%s\"\n",files[i]->GetName());
+			bOk = false;
+		}
+	}
+	return bOk;
 }
 
 
@@ -753,100 +1356,873 @@ void	ZIPParse()
 
 
 
-int main(int argc, char* argv[])
+// The command line tool. The library (Dir2MsaLib) is built without it
+#ifndef DIR2MSA_LIBRARY
+
+//--------------- Image job ----------------------------------------------
+
+enum
+{
+	JOB_OK = 0,
+	JOB_BAD_PATH,
+	JOB_BAD_INPUT,
+	JOB_NO_SPACE,
+	JOB_READ_ERROR,
+	JOB_WRITE_ERROR,
+	JOB_BAD_IMAGE,
+	JOB_OUTPUT_EXISTS,
+};
+
+static	const char*	JobErrorString(int rCode)
 {
+	switch (rCode)
+	{
+		case JOB_OK:			return "ok";
+		case JOB_BAD_PATH:		return "not a valid path";
+		case JOB_BAD_INPUT:		return "not a directory, or not a ZIP file";
+		case JOB_NO_SPACE:		return "does not fit on the disk";
+		case JOB_READ_ERROR:	return "could not read a file";
+		case JOB_WRITE_ERROR:	return "could not write the image";
+		case JOB_BAD_IMAGE:		return "not a valid MSA or ST image";
+		case JOB_OUTPUT_EXISTS:	return "output directory already exists";
+	}
+	return "unknown error";
+}
 
-	printf(	"Dir2Msa v1.1 (beta)\n"
-			"Make an ATARI MSA floppy disk image from\n"
-			"ZIP file archive or a windows directory.\n"
-			"Written by Leonard/OXYGENE\n\n");
+// Bump when the same input gives a different image (it invalidates every cache entry)
+static	const	int		IMAGE_LAYOUT_VERSION	=	2;
 
-	if (32 != sizeof(LFN)) return -1;		// Change the LFN struct depending on your compiler settings (should be 32bytes long)
+struct BuildOptions
+{
+	int				verbosity;		// VERBOSE_xxx
+	bool			bSmallest;		// any known geometry, not only the default one or bigger
+	const std::vector<std::string>	*	pLayoutOrder;		// files to place first (-p), NULL: original layout
+	ImageFormat		format;			// -f: msa or st
+	const char	*	pCacheDir;		// NULL: no incremental build
+	long long		maxFileTime;	// Unix time (SOURCE_DATE_EPOCH), later file dates are clamped to it. -1: none
+	const char	*	pImageName;		// NULL: next to the input (-o of a single build)
+};
+
+// Everything the image depends on: names, sizes, dates and ZIP CRCs (file contents are not read)
+static	void	HashTree(CHash64 &hash,CDirectory *pDir,ZFILE *pZIP)
+{
+	for (int i=0;i<pDir->GetNbEntry();i++)
+	{
+		const CDirEntry *pEntry = pDir->GetEntry(i);
+		hash.AddString(pEntry->GetLongName());
+		hash.AddString(pEntry->GetName());
+		hash.AddInt(pEntry->GetSize());
+		hash.AddInt(((long long)pEntry->GetTime().dwHighDateTime << 32) | pEntry->GetTime().dwLowDateTime);
+		if (pZIP && (pEntry->GetZIPIndex() >= 0))
+			hash.AddInt(zentry(pZIP,pEntry->GetZIPIndex())->crc3);
+		if (pEntry->IsDirectory())
+		{
+			hash.AddInt(-1);
+			HashTree(hash,pEntry->GetDirectory(),pZIP);
+			hash.AddInt(-2);
+		}
+	}
+}
 
-	int rCode = -1;
+static	CDirEntry*	FindEntry(CDirectory *pRoot,const char *pPath)
+{
+	CDirectory *pDir = pRoot;
+	CDirEntry *pFound = NULL;
+	while (*pPath)
+	{
+		size_t len = strcspn(pPath,"/\\");
+		if (len > 0)
+		{
+			if (NULL == pDir)
+				return NULL;				// a file is not a directory
+			std::string name(pPath,len);
+			pFound = NULL;
+			for (int i=0;(i<pDir->GetNbEntry()) && (NULL == pFound);i++)
+			{
+				CDirEntry *pEntry = pDir->GetEntry(i);
+				if ((0 == stricmp(pEntry->GetLongName(),name.c_str())) || (0 == stricmp(pEntry->GetName(),name.c_str())))
+					pFound = pEntry;
+			}
+			if (NULL == pFound)
+				return NULL;
+			pDir = pFound->GetDirectory();
+		}
+		pPath += len;
+		if (*pPath)
+			pPath++;
+	}
+	return pFound;
+}
 
+// Files of the layout order, first occurrence only. A directory stands for all its files.
+// Returns the number of paths not found in the tree
+static	int		ResolveLayoutOrder(CDirectory *pRoot,const std::vector<std::string> &paths,std::vector<CDirEntry*> &files)
+{
+	int nbMissing = 0;
+	std::unordered_set<CDirEntry*> placed;
+	for (size_t i=0;i<paths.size();i++)
+	{
+		CDirEntry *pEntry = FindEntry(pRoot,paths[i].c_str());
+		if (NULL == pEntry)
+		{
+			nbMissing++;
+			continue;
+		}
 
-/*
-	ZIPParse();
-	return 0;
-*/
+		std::vector<CDirEntry*> entries;
+		if (pEntry->IsDirectory())
+			CollectFiles(pEntry->GetDirectory(),entries);
+		else if (pEntry->GetSize() > 0)
+			entries.push_back(pEntry);
 
+		for (size_t j=0;j<entries.size();j++)
+		{
+			if (placed.insert(entries[j]).second)
+				files.push_back(entries[j]);
+		}
+	}
+	return nbMissing;
+}
 
-	if (argc != 2)
+static	HASH64	ManifestHash(CDirectory *pDir,ZFILE *pZIP,const BuildOptions &options)
+{
+	CHash64 hash;
+	hash.AddInt(IMAGE_LAYOUT_VERSION);
+	hash.AddInt(options.bSmallest);			// the geometry only depends on it and the tree
+	if (options.pLayoutOrder)
 	{
-		printf(	"Usage: dir2msa <directory path>\n"
-				"ex: dir2floppy c:\\harddisk\\demo1\n"
-				"    copy every files and folders from c:\\harddisk\\demo1\\*.* to\n"
-				"    c:\\harddisk\\demo1.msa file.\n");
+		for (size_t i=0;i<options.pLayoutOrder->size();i++)
+			hash.AddString((*options.pLayoutOrder)[i].c_str());
+	}
+	hash.AddInt(-1);
+	hash.AddInt(options.maxFileTime);
+	HashTree(hash,pDir,pZIP);
+	return hash.Get();
+}
+
+static	bool	WriteHostFile(const char *pName,const unsigned char *pData,size_t size)
+{
+	FILE *h = fopen(pName,"wb");
+	if (NULL == h)
+		return false;
+	bool bOk = (size == fwrite(pData,1,size,h));
+	return (0 == fclose(h)) && bOk;
+}
+
+// Build the image of one directory or ZIP file ("-": ZIP archive from stdin). pPool is used to load files and pack tracks.
+// *pbCacheHit tells if the image was only copied from the cache. pStats (optional) gets the job counters.
+static	int		BuildImage(const char *pInput,CFloppy &floppy,CThreadPool *pPool,const BuildOptions &options,char *sImageName,bool *pbCacheHit,JobStats *pStats)
+{
+	bool bVerbose = (options.verbosity >= VERBOSE_NORMAL);
+	*pbCacheHit = false;
+
+	bool bStdin = (0 == strcmp(pInput,"-"));
+	int pathType = bStdin ? 1 : HostPathType(pInput);
+	if (0 == pathType)
+		return JOB_BAD_PATH;
+
+	CArena arena;				// the whole tree, freed at once when the job ends
+	CDirectory *pDir = NULL;
+	CFileSource *pSource = NULL;
+	HASH64 manifest = 0;
+
+	CPhaseTimer timer(pStats,PHASE_SCAN);
+	if (bStdin)
+	{	// can't seek: the members are inflated while reading it
+		if (bVerbose)
+			printf("Reading ZIP archive from stdin...\n");
+		sprintf(sImageName,"stdin%s",ImageFormatExtension(options.format));
+		CZIPStreamSource *pStream = new CZIPStreamSource;
+		pSource = pStream;
+		if (HostSetBinaryMode(stdin))
+			pDir = pStream->Read(stdin,&arena);
+	}
+	else if (2 == pathType)
+	{
+		if (bVerbose)
+			printf("Parsing directory tree...\n");
+		sprintf(sImageName,"%s%s",pInput,ImageFormatExtension(options.format));
+		pDir = CreateTreeFromDirectory(pInput,&arena);
+		pSource = new CHostFileSource;
+		manifest = ManifestHash(pDir,NULL,options);
 	}
 	else
+	{	// maybe it's a ZIP file
+		CZIPFileSource *pZIPSource = new CZIPFileSource( pInput );
+		ZFILE* pZIP = pZIPSource->Open();
+		if ( pZIP && !zIsZIP( pZIP ) )
+		{	// zopen accepts any file as a single stored one
+			zclose( pZIP );
+			pZIP = NULL;
+		}
+
+		if ( pZIP )
+		{
+			if (bVerbose)
+				printf("Parsing ZIP archive file...\n");
+
+			char sDrive[ _MAX_DRIVE ];
+			char sDirName[ _MAX_DIR ];
+			char sFname[ _MAX_FNAME ];
+			_splitpath( pInput, sDrive, sDirName, sFname, NULL );
+			_makepath( sImageName, sDrive, sDirName, sFname, ImageFormatExtension( options.format ) );
+
+			pDir = CreateTreeFromZIP( pZIP, &arena );
+			if ( pDir )
+				manifest = ManifestHash( pDir, pZIP, options );
+			zclose( pZIP );
+			pSource = pZIPSource;
+		}
+		else
+			delete pZIPSource;
+	}
+
+	if (NULL == pDir)
 	{
+		delete pSource;
+		return JOB_BAD_INPUT;
+	}
 
-		FileDescriptor info;
-		if (INVALID_HANDLE_VALUE != FindFirstFile(argv[1],&info))
+	if (options.pImageName)
+		strcpy(sImageName,options.pImageName);
+
+	timer.Next(PHASE_PLAN);
+
+	// Pick the geometry from the tree sizes, so the image is only built once
+	CCapacityPlan plan;
+	plan.Compute(pDir);
+	const DiskGeometry *pGeometry = plan.SelectGeometry(options.bSmallest);
+	if (NULL == pGeometry)
+	{
+		if (bVerbose)
+		{
+			int nbGeometry;
+			const DiskGeometry &biggest = GetGeometryTable(&nbGeometry)[nbGeometry-1];
+			if (plan.GetNbRootEntry() > biggest.nbRootEntry)
+				printf("ERROR: Too much files in root directory (%d > %d)\n",plan.GetNbRootEntry()-1,biggest.nbRootEntry);
+			else
+				printf("ERROR: No more space on the disk (%lld KB needed, %d KB free on the biggest format)\n",plan.GetNbCluster(),biggest.GetNbCluster());
+		}
+		delete pSource;
+		return JOB_NO_SPACE;
+	}
+
+	// the cache keeps .msa files only, and a stream has no manifest
+	bool bCache = options.pCacheDir && (IMAGE_FORMAT_MSA == options.format) && !bStdin;
+	CCacheEntry previous;
+	char sEntryName[_MAX_PATH];
+	if (bCache)
+	{
+		CacheEntryName(options.pCacheDir,sImageName,sEntryName);
+		if (previous.Load(sEntryName) && (manifest == previous.m_manifest))
 		{
+			if (bVerbose)
+				printf("Input did not change, writing \"%s\" from the cache\n",sImageName);
+			delete pSource;
+			*pbCacheHit = true;
+			return WriteHostFile(sImageName,previous.m_msa.data(),previous.m_msa.size()) ? JOB_OK : JOB_WRITE_ERROR;
+		}
+	}
 
-			CDirectory *pDir = NULL;
-			char sImageName[_MAX_PATH];
+	timer.Next(PHASE_FILL);
+	floppy.SetVerbosity(options.verbosity);
+	floppy.SetStats(pStats);
+	floppy.SetMaxFileTime(options.maxFileTime);
+	if (bVerbose)
+		printf("Geometry: %d side(s), %d cylinders, %d sectors per track\n",pGeometry->nbSide,pGeometry->nbCylinder,pGeometry->nbSectorPerTrack);
+	floppy.Create(*pGeometry);
 
-			if (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	std::vector<CDirEntry*> order;
+	if (options.pLayoutOrder)
+	{
+		int nbMissing = ResolveLayoutOrder(pDir,*options.pLayoutOrder,order);
+		if (nbMissing && bVerbose)
+			printf("WARNING: %d path(s) of the layout order are not in the input\n",nbMissing);
+	}
+
+	bool bOk = floppy.Fill( pDir, options.pLayoutOrder ? &order : NULL );
+
+	int rCode = JOB_NO_SPACE;
+	if (bOk)
+	{
+		rCode = JOB_READ_ERROR;
+		timer.Next(PHASE_LOAD);
+		bool bLoaded = floppy.LoadFiles(pSource,pPool);
+		if (pStats)
+			pSource->AddStats(pStats);
+		if (bLoaded)
+		{
+			timer.Next(PHASE_WRITE);
+			if (bVerbose)
+				printf("\nWriting file \"%s\"\n",sImageName);
+			if (bCache)
 			{
-				printf("Parsing directory tree...\n");
-				sprintf(sImageName,"%s.msa",argv[1]);
-				pDir = CreateTreeFromDirectory(argv[1]);
+				CCacheEntry result;
+				result.m_manifest = manifest;
+				CMsaWriter writer(&previous,&result);
+				rCode = writer.Write(floppy,sImageName,pPool) ? JOB_OK : JOB_WRITE_ERROR;
+				if ((JOB_OK == rCode) && !result.Save(sEntryName) && bVerbose)
+					printf("WARNING: Could not write cache entry \"%s\"\n",sEntryName);
 			}
 			else
-			{	// maybe it's a ZIP file
-				ZFILE* pZIP = zopen( argv[1], "rb" );
-				if ( pZIP )
-				{
-					printf("Parsing ZIP archive file...\n");
+			{
+				CImageWriter *pWriter = CImageWriter::Create(options.format);
+				rCode = pWriter->Write(floppy,sImageName,pPool) ? JOB_OK : JOB_WRITE_ERROR;
+				delete pWriter;
+			}
+		}
+	}
+
+	floppy.SetStats(NULL);
+	delete pSource;
+	return rCode;
+}
 
-					char sDrive[ _MAX_DRIVE ];
-					char sDirName[ _MAX_DIR ];
-					char sFname[ _MAX_FNAME ];
-					_splitpath( argv[1], sDrive, sDirName, sFname, NULL );
-					_makepath( sImageName, sDrive, sDirName, sFname, ".msa" );
 
-					pDir = CreateTreeFromZIP( argv[ 1 ], pZIP );
-				//	zclose( pZIP );
-				}
-			}
+//--------------- Image extraction ---------------------------------------
+
+static	void	PrintDosDate(unsigned short date,unsigned short time16)
+{
+	printf("%04d-%02d-%02d %02d:%02d",1980 + (date>>9),(date>>5)&15,date&31,time16>>11,(time16>>5)&63);
+}
+
+// List the content of a MSA or ST image
+static	int		ListImage(const char *pInput)
+{
+	CImageReader reader;
+	if (!reader.Open(pInput))
+		return JOB_BAD_IMAGE;
+
+	std::vector<ImageFileInfo> files;
+	bool bOk = reader.ListFiles(files);
+
+	printf("%s: %d side(s), %d cylinders, %d sectors per track\n",pInput,reader.GetNbSide(),reader.GetNbCylinder(),reader.GetNbSectorPerTrack());
+	int nbFile = 0;
+	long long nbByte = 0;
+	for (size_t i=0;i<files.size();i++)
+	{
+		const ImageFileInfo &file = files[i];
+		if (file.IsDirectory())
+			printf("     <DIR>  ");
+		else
+		{
+			printf("%10d  ",file.size);
+			nbFile++;
+			nbByte += file.size;
+		}
+		PrintDosDate(file.updateDate,file.updateTime);
+		printf("  %s%s\n",file.path.c_str(),file.IsDirectory() ? "/" : "");
+	}
+	printf("%d file(s), %lld byte(s)\n\n",nbFile,nbByte);
+
+	return bOk ? JOB_OK : JOB_BAD_IMAGE;
+}
+
+// Unpack a MSA or ST image to a new directory named after it (in pOutRoot if not NULL)
+static	int		ExtractImage(const char *pInput,const char *pOutRoot,bool bVerbose,char *sOutName)
+{
+	char sDrive[ _MAX_DRIVE ];
+	char sDirName[ _MAX_DIR ];
+	char sFname[ _MAX_FNAME ];
+	_splitpath( pInput, sDrive, sDirName, sFname, NULL );
+	if (pOutRoot)
+		_makepath( sOutName, NULL, pOutRoot, sFname, NULL );
+	else
+		_makepath( sOutName, sDrive, sDirName, sFname, NULL );
+
+	CImageReader reader;
+	if (!reader.Open(pInput))
+		return JOB_BAD_IMAGE;
+
+	std::vector<ImageFileInfo> files;
+	if (!reader.ListFiles(files))
+		return JOB_BAD_IMAGE;
+
+	if (0 != HostPathType(sOutName))
+		return JOB_OUTPUT_EXISTS;
+	if (!HostMakeDir(sOutName))
+		return JOB_WRITE_ERROR;
+
+	std::vector<unsigned char> data;
+	for (size_t i=0;i<files.size();i++)
+	{
+		const ImageFileInfo &file = files[i];
+		std::string path = std::string(sOutName) + "/" + file.path;
+		if (bVerbose)
+			printf("%s\n",file.path.c_str());
+
+		if (file.IsDirectory())
+		{
+			if (!HostMakeDir(path.c_str()))
+				return JOB_WRITE_ERROR;
+			continue;
+		}
+
+		data.resize(file.size);
+		if (!reader.ReadFile(file,data.data()))
+		{
+			if (bVerbose)
+				printf("ERROR: Could not read \"%s\"\n",file.path.c_str());
+			return JOB_BAD_IMAGE;
+		}
+
+		FILE *h = fopen(path.c_str(),"wb");
+		if (NULL == h)
+			return JOB_WRITE_ERROR;
+		bool bOk = ((size_t)file.size == fwrite(data.data(),1,file.size,h));
+		if ((0 != fclose(h)) || !bOk)
+			return JOB_WRITE_ERROR;
+
+		FILETIME ft;
+		if (DosDateTimeToFileTime(file.updateDate,file.updateTime,&ft))
+			HostSetFileTime(path.c_str(),&ft);
+	}
+
+	if (bVerbose && reader.IsMSA())
+		printf("\n%d of %d track(s) unpacked\n",reader.GetNbUnpackedTrack(),reader.GetNbCylinder() * reader.GetNbSide());
+	return JOB_OK;
+}
+
+
+//--------------- Batch mode ---------------------------------------------
+
+struct BatchJob
+{
+	std::string		input;
+	char			sImageName[_MAX_PATH];
+	int				rCode;
+	bool			bCacheHit;
+	double			ms;
+	JobStats		stats;
+};
+
+struct StatsOptions
+{
+	bool			bPrint;			// -stats
+	const char	*	pJSONName;		// -stats-json, NULL: none
+	bool			IsOn() const	{ return bPrint || pJSONName; }
+};
+
+static	bool	WriteStatsJSON(const char *pName,const BatchJob *pJobs,int nbJob)
+{
+	FILE *h = fopen(pName,"w");
+	if (NULL == h)
+		return false;
+	fprintf(h,"{\n\t\"version\": 1,\n\t\"peak_memory_bytes\": %lld,\n\t\"jobs\": [\n",HostPeakMemory());
+	for (int i=0;i<nbJob;i++)
+	{
+		const BatchJob &job = pJobs[i];
+		fprintf(h,"\t\t");
+		WriteJobStatsJSON(h,job.stats,job.input.c_str(),job.sImageName,job.bCacheHit ? "cached" : JobErrorString(job.rCode));
+		fprintf(h,"%s\n",(i + 1 < nbJob) ? "," : "");
+	}
+	fprintf(h,"\t]\n}\n");
+	return 0 == fclose(h);
+}
+
+// Printed and/or written once every job is done. false if the JSON file could not be written
+static	bool	OutputStats(const StatsOptions &statsOptions,const BatchJob *pJobs,int nbJob)
+{
+	if (statsOptions.bPrint)
+	{
+		for (int i=0;i<nbJob;i++)
+		{
+			printf("\nStats of \"%s\":\n",pJobs[i].input.c_str());
+			PrintJobStats(pJobs[i].stats);
+		}
+		printf("\nPeak memory: %lld KB\n",HostPeakMemory() / 1024);
+	}
+	if (statsOptions.pJSONName && !WriteStatsJSON(statsOptions.pJSONName,pJobs,nbJob))
+	{
+		printf("ERROR: Could not write \"%s\"\n",statsOptions.pJSONName);
+		return false;
+	}
+	return true;
+}
+
+// One entry per line, '#' starts a comment
+static	bool	ReadListFile(const char *pListName,std::vector<std::string> &lines)
+{
+	FILE *h = fopen(pListName,"r");
+	if (NULL == h)
+		return false;
+
+	char sLine[_MAX_PATH];
+	while (fgets(sLine,sizeof(sLine),h))
+	{
+		char *pEnd = sLine + strlen(sLine);
+		while ((pEnd > sLine) && (('\n' == pEnd[-1]) || ('\r' == pEnd[-1]) || (' ' == pEnd[-1])))
+			*--pEnd = 0;
+		if ((0 == sLine[0]) || ('#' == sLine[0]))
+			continue;
+		lines.push_back(sLine);
+	}
+	fclose(h);
+	return true;
+}
+
+static	bool	AddInputList(const char *pListName,std::vector<std::string> &inputs)
+{
+	std::vector<std::string> lines;
+	if (!ReadListFile(pListName,lines))
+		return false;
+	for (size_t i=0;i<lines.size();i++)
+		HostGlob(lines[i].c_str(),inputs);
+	return true;
+}
+
+// Build (or extract) every image on one work-stealing pool. Floppies are reused from
+// job to job, so the raw image buffers are allocated about once per worker.
+static	int		RunBatch(const std::vector<std::string> &inputs,int nbThread,bool bExtract,const char *pOutRoot,const BuildOptions &options,const StatsOptions &statsOptions)
+{
+	CThreadPool pool(nbThread);
+	CFloppyPool floppies;
+	std::vector<BatchJob> jobs(inputs.size());
+
+
+	printf("%s %d image(s) with %d thread(s)...\n",bExtract ? "Extracting" : "Building",(int)inputs.size(),pool.GetNbThread());
 
-			if (pDir)
+	for (size_t i=0;i<inputs.size();i++)
+	{
+		BatchJob *pJob = &jobs[i];
+		pJob->input = inputs[i];
+		pJob->sImageName[0] = 0;
+		pJob->bCacheHit = false;
+		JobStats *pStats = statsOptions.IsOn() ? &pJob->stats : NULL;
+		pool.Submit([pJob,pStats,&pool,&floppies,bExtract,pOutRoot,&options]
+		{
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			if (bExtract)
+				pJob->rCode = ExtractImage(pJob->input.c_str(),pOutRoot,false,pJob->sImageName);
+			else
 			{
-				CFloppy floppy;
-				floppy.Create(NB_HEAD,NB_SECTOR_PER_TRACK,NB_CYLINDER);
+				CFloppy *pFloppy = floppies.Take();
+				pJob->rCode = BuildImage(pJob->input.c_str(),*pFloppy,&pool,options,pJob->sImageName,&pJob->bCacheHit,pStats);
+				floppies.Give(pFloppy);
+			}
+			pJob->ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - t0).count();
+		});
+	}
+	pool.Wait();
 
-				bool bOk = floppy.Fill( pDir );
-				if (!bOk)
-				{
-					printf("Try to generate a 11 sector floppy...\n");
-					floppy.Destroy();
-					floppy.Create(NB_HEAD,NB_SECTOR_PER_TRACK+1,NB_CYLINDER);
-					bOk = floppy.Fill( pDir );
-				}
+	int nbFailed = 0;
+	for (size_t i=0;i<jobs.size();i++)
+	{
+		const BatchJob &job = jobs[i];
+		if (JOB_OK == job.rCode)
+			printf("  OK    %8.1f ms  %s -> %s%s\n",job.ms,job.input.c_str(),job.sImageName,job.bCacheHit ? " (cached)" : "");
+		else
+		{
+			printf("  FAIL  %8.1f ms  %s (%s)\n",job.ms,job.input.c_str(),JobErrorString(job.rCode));
+			nbFailed++;
+		}
+	}
+	printf("\n%d job(s): %d ok, %d failed\n",(int)jobs.size(),(int)jobs.size()-nbFailed,nbFailed);
 
-				if (bOk)
-				{
-					printf("\nWriting file \"%s\"\n",sImageName);
-					floppy.WriteImage(sImageName);
-					rCode = 0;		// return with no errors
-				}
+	if (!bExtract && statsOptions.IsOn() && !OutputStats(statsOptions,jobs.data(),(int)jobs.size()))
+		nbFailed++;
 
-				delete pDir;
+	return nbFailed ? -1 : 0;
+}
+
+
+static	void	Usage()
+{
+	printf(	"Usage: dir2msa [-s] [-p <order file>] [-f msa|st] [-v] [-stats] [-stats-json <file>] <directory path>\n"
+			"   or: dir2msa [options] [-o <image>] -\n"
+			"ex: dir2floppy c:\\harddisk\\demo1\n"
+			"    copy every files and folders from c:\\harddisk\\demo1\\*.* to\n"
+			"    c:\\harddisk\\demo1.msa file.\n"
+			"    -s : smallest floppy that fits (default: 2 sides, 81 cylinders,\n"
+			"         10 sectors per track, or bigger if needed)\n"
+			"    -p : layout order file: paths in the input (one per line), in the\n"
+			"         order the demo loads them. They are placed first, contiguous and\n"
+			"         on track boundaries when possible, after every directory\n"
+			"    -f : image format, msa (default) or st (raw sectors)\n"
+			"    -v : list every file and folder written to the image\n"
+			"    -stats : print time per phase, bytes read, clusters and MSA packing\n"
+			"    -stats-json : write the same as JSON (both work in batch mode too)\n"
+			"    - : read a ZIP archive from stdin, in one pass (it can be a pipe),\n"
+			"        to \"stdin.msa\" or the -o image\n"
+			"\n"
+			"Batch: dir2msa [-j <threads>] [-l <list file>] [-c <cache dir>] <path or pattern> ...\n"
+			"    build one image per directory or ZIP file, in parallel.\n"
+			"    -j : number of worker threads (default: one per core)\n"
+			"    -l : text file with one path or pattern per line\n"
+			"    -c : cache directory, to only rebuild images whose input changed (msa only)\n"
+			"\n"
+			"Extract: dir2msa -x [-o <output dir>] [-j <threads>] <image or pattern> ...\n"
+			"    unpack each MSA or ST image to a new directory of the same name.\n"
+			"    -o : create the directories there instead of next to the images\n"
+			"         (created, with its parents, if missing)\n"
+			"List: dir2msa -t <image or pattern> ...\n"
+			"\n"
+			"Benchmark: dir2msa -bench [-o <result.json>] [-baseline <result.json>] [-threshold <percent>]\n"
+			"    time every stage on generated inputs (in the temp directory).\n"
+			"    -o : write the timings as JSON\n"
+			"    -baseline : compare with a previous result, fail if a stage is slower\n"
+			"                by more than the threshold (default 10%%)\n"
+			"\n"
+			"Server: dir2msa -serve <socket> [-j <threads>]\n"
+			"    keep running and build images for clients on a local socket.\n"
+			"Client: dir2msa -client <socket> [-s] [-f msa|st] [-o <image>] [-inline] <path>\n"
+			"    same as a single build, done by the server.\n"
+			"    -o : image name (default: next to the input)\n"
+			"    -inline : send the ZIP file and get the image back through the\n"
+			"              socket, when the server can't reach the files\n"
+			"    dir2msa -client <socket> -stop : stop the server\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+
+	printf(	"Dir2Msa v1.1 (beta)\n"
+			"Make an ATARI MSA floppy disk image from\n"
+			"ZIP file archive or a windows directory.\n"
+			"Written by Leonard/OXYGENE\n\n");
+
+	if (32 != sizeof(LFN)) return -1;		// Change the LFN struct depending on your compiler settings (should be 32bytes long)
+
+	int rCode = -1;
+
+
+/*
+	ZIPParse();
+	return 0;
+*/
+
+	std::vector<std::string> inputs;
+	bool bBatch = false;
+	BuildOptions options;
+	options.verbosity = VERBOSE_NORMAL;
+	options.bSmallest = false;
+	options.pLayoutOrder = NULL;
+	options.format = IMAGE_FORMAT_MSA;
+	options.pCacheDir = NULL;
+	options.maxFileTime = -1;
+	options.pImageName = NULL;
+	std::vector<std::string> layoutOrder;
+
+	// reproducible builds convention
+	const char *pEpoch = getenv("SOURCE_DATE_EPOCH");
+	if (pEpoch && *pEpoch)
+		options.maxFileTime = strtoll(pEpoch,NULL,10);
+	bool bExtract = false;
+	bool bList = false;
+	const char *pOutRoot = NULL;
+	int nbThread = 0;
+	StatsOptions statsOptions;
+	statsOptions.bPrint = false;
+	statsOptions.pJSONName = NULL;
+	bool bBench = false;
+	BenchOptions bench;
+	bench.pBaselineName = NULL;
+	bench.threshold = 10.0;
+	const char *pServeSocket = NULL;
+	ClientOptions client;
+	client.pSocketName = NULL;
+	client.bInline = false;
+	client.bStop = false;
+
+	for (int i=1;i<argc;i++)
+	{
+		if ((0 == strcmp(argv[i],"-j")) && (i+1 < argc))
+		{
+			nbThread = atoi(argv[++i]);
+			bBatch = true;
+		}
+		else if ((0 == strcmp(argv[i],"-l")) && (i+1 < argc))
+		{
+			if (!AddInputList(argv[++i],inputs))
+			{
+				printf("ERROR: Could not read list file \"%s\"\n",argv[i]);
+				return -1;
 			}
+			bBatch = true;
+		}
+		else if (0 == strcmp(argv[i],"-x"))
+		{
+			bExtract = true;
+		}
+		else if (0 == strcmp(argv[i],"-t"))
+		{
+			bList = true;
+		}
+		else if (0 == strcmp(argv[i],"-v"))
+		{
+			options.verbosity = VERBOSE_ENTRIES;
+		}
+		else if (0 == strcmp(argv[i],"-stats"))
+		{
+			statsOptions.bPrint = true;
+		}
+		else if ((0 == strcmp(argv[i],"-stats-json")) && (i+1 < argc))
+		{
+			statsOptions.pJSONName = argv[++i];
+		}
+		else if (0 == strcmp(argv[i],"-bench"))
+		{
+			bBench = true;
+		}
+		else if ((0 == strcmp(argv[i],"-baseline")) && (i+1 < argc))
+		{
+			bench.pBaselineName = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i],"-threshold")) && (i+1 < argc))
+		{
+			bench.threshold = atof(argv[++i]);
+		}
+		else if ((0 == strcmp(argv[i],"-serve")) && (i+1 < argc))
+		{
+			pServeSocket = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i],"-client")) && (i+1 < argc))
+		{
+			client.pSocketName = argv[++i];
+		}
+		else if (0 == strcmp(argv[i],"-inline"))
+		{
+			client.bInline = true;
+		}
+		else if (0 == strcmp(argv[i],"-stop"))
+		{
+			client.bStop = true;
+		}
+		else if ((0 == strcmp(argv[i],"-f")) && (i+1 < argc))
+		{
+			i++;
+			if (0 == stricmp(argv[i],"st"))
+				options.format = IMAGE_FORMAT_ST;
+			else if (0 == stricmp(argv[i],"msa"))
+				options.format = IMAGE_FORMAT_MSA;
 			else
 			{
-				printf("ERROR on \"%s\":\nNot a directory, or not a ZIP file\n",argv[1]);
+				printf("ERROR: Unknown image format \"%s\" (msa or st)\n",argv[i]);
+				return -1;
+			}
+		}
+		else if (0 == strcmp(argv[i],"-s"))
+		{
+			options.bSmallest = true;
+		}
+		else if ((0 == strcmp(argv[i],"-p")) && (i+1 < argc))
+		{
+			if (!ReadListFile(argv[++i],layoutOrder))
+			{
+				printf("ERROR: Could not read layout order file \"%s\"\n",argv[i]);
+				return -1;
+			}
+			options.pLayoutOrder = &layoutOrder;
+		}
+		else if ((0 == strcmp(argv[i],"-o")) && (i+1 < argc))
+		{
+			pOutRoot = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i],"-c")) && (i+1 < argc))
+		{
+			options.pCacheDir = argv[++i];
+			if (!HostMakeDir(options.pCacheDir))
+			{
+				printf("ERROR: Could not create cache directory \"%s\"\n",options.pCacheDir);
+				return -1;
 			}
 		}
 		else
 		{
-			printf("ERROR: \"%s\" is not a valid path\n",argv[1]);
+			HostGlob(argv[i],inputs);
 		}
-	}	
+	}
+
+	if (bExtract && pOutRoot && !inputs.empty() && !HostMakeDirs(pOutRoot))
+	{
+		printf("ERROR: Could not create output directory \"%s\"\n",pOutRoot);
+		return -1;
+	}
+
+	if (bBench)
+	{
+		bench.pResultName = pOutRoot;
+		rCode = RunBench(bench);
+	}
+	else if (pServeSocket)
+	{
+		ServerOptions server;
+		server.pSocketName = pServeSocket;
+		server.nbThread = nbThread;
+		rCode = RunServer(server);
+	}
+	else if (client.pSocketName && (client.bStop || (1 == inputs.size())))
+	{
+		client.pInput = client.bStop ? NULL : inputs[0].c_str();
+		client.pImageName = pOutRoot;
+		client.format = options.format;
+		client.bSmallest = options.bSmallest;
+		client.maxFileTime = options.maxFileTime;
+		rCode = RunClient(client);
+	}
+	else if (inputs.empty())
+	{
+		Usage();
+	}
+	else if (bList)
+	{
+		rCode = 0;
+		for (size_t i=0;i<inputs.size();i++)
+		{
+			int jobCode = ListImage(inputs[i].c_str());
+			if (JOB_OK != jobCode)
+			{
+				printf("ERROR on \"%s\":\n%s\n",inputs[i].c_str(),JobErrorString(jobCode));
+				rCode = -1;
+			}
+		}
+	}
+	else if (bBatch || (inputs.size() > 1))
+	{
+		options.verbosity = VERBOSE_QUIET;
+		rCode = RunBatch(inputs,nbThread,bExtract,pOutRoot,options,statsOptions);
+	}
+	else if (bExtract)
+	{
+		char sOutName[_MAX_PATH];
+		const char *pInput = inputs[0].c_str();
+
+		int jobCode = ExtractImage(pInput,pOutRoot,true,sOutName);
+		if (JOB_OK == jobCode)
+			rCode = 0;
+		else
+			printf("ERROR on \"%s\":\n%s\n",pInput,JobErrorString(jobCode));
+	}
+	else
+	{
+		CThreadPool pool;
+		CFloppy floppy;
+		BatchJob job;
+		job.input = inputs[0];
+		job.sImageName[0] = 0;
+		char *sImageName = job.sImageName;
+		const char *pInput = inputs[0].c_str();
+		options.pImageName = pOutRoot;
+
+		int jobCode = BuildImage(pInput,floppy,&pool,options,sImageName,&job.bCacheHit,statsOptions.IsOn() ? &job.stats : NULL);
+		job.rCode = jobCode;
+		if (JOB_OK == jobCode)
+			rCode = 0;		// return with no errors
+		else if (JOB_BAD_PATH == jobCode)
+			printf("ERROR: \"%s\" is not a valid path\n",pInput);
+		else if (JOB_BAD_INPUT == jobCode)
+			printf("ERROR on \"%s\":\nNot a directory, or not a ZIP file\n",pInput);
+		else if (JOB_READ_ERROR == jobCode)
+			printf("ERROR on \"%s\":\nCould not read every file\n",pInput);
+		else if (JOB_WRITE_ERROR == jobCode)
+			printf("ERROR: Could not write \"%s\"\n",sImageName);
+
+		if (statsOptions.IsOn() && !OutputStats(statsOptions,&job,1))
+			rCode = -1;
+	}
 
 	return rCode;
 }
 
+#endif // DIR2MSA_LIBRARY
@@ -2,11 +2,19 @@
 #ifndef __DIR2FLOPPY__
 #define __DIR2FLOPPY__
 
-#include "zip/zipio.h"
+#include <mutex>
+#include <vector>
+#include "Platform.h"
+#include "Geometry.h"
+#include "Stats.h"
+#include "ZIP/ZIPIO.H"
 
 typedef		WIN32_FIND_DATA		FileDescriptor;
 
+class CArena;
+class CCacheEntry;
 class CDirectory;
+class CThreadPool;
 
 struct	LFN
 {
@@ -17,7 +25,7 @@ struct	LFN
 	unsigned short	updateTime;
 	unsigned short	updateDate;
 	unsigned short	firstCluster;
-	unsigned long	fileSize;
+	unsigned int	fileSize;
 };
 
 struct MSAHEADER
@@ -25,60 +33,159 @@ struct MSAHEADER
 	unsigned short	ID,Sectors, Sides, StartTrack, EndTrack;
 };
 
+// One file or directory. Small fixed size record, names are interned in the job arena.
 class CDirEntry
 {
 public:
-	CDirEntry();
-	~CDirEntry();
+	void				Create(const FileDescriptor *pInfo,CDirectory *pParent,CDirectory *pSubDir,int zipIndex,CArena *pArena);
 
+	CDirectory		*	GetDirectory() const	{ return m_pDirectory; }
+	CDirectory		*	GetParent() const		{ return m_pParent; }
+	const char		*	GetName() const			{ return m_pName; }			// 8.3 alternate name when the host gives one
+	const char		*	GetLongName() const		{ return m_pLongName; }		// host name
+	const FILETIME	&	GetTime() const			{ return m_time; }
+	bool				GetHostPath(char *sPath) const;
 
-	void				Create(const FileDescriptor *pInfo,CDirectory *pSubDir,const char *pHostName, ZFILE* pZIP = NULL );
-
-	CDirectory		*	GetDirectory()		{ return m_pDirectory; }
-	const char		*	GetName() const
-	{
-		if (*m_info.cAlternateFileName)
-			return m_info.cAlternateFileName;
-		else
-			return m_info.cFileName;
-	}
-
-	const char		*	GetHostName() const	{ return m_sHostName; }
-	int					GetSize()			{ return m_info.nFileSizeLow; }
+	int					GetZIPIndex() const	{ return m_zipIndex; }
+	int					GetSize() const		{ return (int)m_size; }
+	int					GetFirstCluster() const			{ return m_firstCluster; }
+	void				SetFirstCluster(int cluster)	{ m_firstCluster = cluster; }
 
 	bool				IsDirectory() const	{ return NULL != m_pDirectory; }
-	CDirEntry		*	GetNext()		{ return m_pNext; }
-	void				SetNext(CDirEntry *pNext)		{ m_pNext = pNext; }
-
-	void				LFN_Create(LFN *pLFN,int clusterStart);
-
-public:
-	FileDescriptor		m_info;
-	char				m_sHostName[_MAX_PATH];
 
-	void*				m_pFileData;
+	void				LFN_Create(LFN *pLFN,int clusterStart,const FILETIME *pMaxTime) const;
 
+private:
+	const char		*	m_pName;
+	const char		*	m_pLongName;
+	CDirectory		*	m_pParent;
 	CDirectory		*	m_pDirectory;
-	CDirEntry		*	m_pNext;
+	FILETIME			m_time;
+	DWORD				m_size;
+	int					m_zipIndex;			// index in the ZIP archive or in-memory file list, -1 for host files
+	int					m_firstCluster;
 };
 
+// Entries are kept in one contiguous array (grown in the arena). GetEntry(0) is the last
+// added one, like the original linked list: that order is the on-disk order.
 class CDirectory
 {
 public:
-	CDirectory();
-	~CDirectory();
+	static	CDirectory*	Create(CArena *pArena,const char *pHostPath);
 
-	void	AddEntry(const FileDescriptor *pInfo,CDirectory *pSubDir,const char *pHostName, ZFILE* pZIP = NULL );
+	// The returned pointer is valid until the next AddEntry in this directory
+	CDirEntry*	AddEntry(const FileDescriptor *pInfo,CDirectory *pSubDir,int zipIndex = -1);
 
-	void	Dump(const char *pPath);
+	void	Dump(const char *pPath) const;
 	int		GetNbEntry() const				{ return m_nbEntry; }
-	CDirEntry	*	GetFirstEntry()	const	{ return m_pEntryList; }
+	CDirEntry	*	GetEntry(int i) const	{ return m_pEntries + (m_nbEntry - 1 - i); }
+	const char	*	GetHostPath() const		{ return m_pHostPath; }
 
-	CDirectory*		DirExist()	const;
+	void	SortByName();
 
 private:
+	CArena		*	m_pArena;
+	const char	*	m_pHostPath;		// NULL in a ZIP tree
+	CDirEntry	*	m_pEntries;
 	int				m_nbEntry;
-	CDirEntry	*	m_pEntryList;
+	int				m_capacity;
+};
+
+
+// Trees live in the arena (freed with it). NULL if the ZIP has no central directory
+CDirectory	*	CreateTreeFromDirectory(const char *pHostDirName,CArena *pArena);
+CDirectory	*	CreateTreeFromZIP(ZFILE *pFile,CArena *pArena);
+
+// One path of an in-memory tree ("A/B/NAME.EXT", or "A/B/" for a directory)
+struct PathEntry
+{
+	const char	*	pPath;
+	DWORD			size;
+	FILETIME		time;
+};
+
+// Missing parent directories are created. File i gets the source index i
+CDirectory	*	CreateTreeFromPaths(const PathEntry *pEntries,int nbEntry,CArena *pArena);
+
+// Where the file contents come from. Load() is called from pool workers, with
+// the worker index, and must copy exactly GetSize() bytes to pDst.
+class CFileSource
+{
+public:
+	virtual			~CFileSource()				{}
+	virtual	void	SetNbWorker(int /*nbWorker*/)	{}
+	virtual	bool	Load(const CDirEntry *pEntry,unsigned char *pDst,int worker) = 0;
+	virtual	void	AddStats(JobStats * /*pStats*/) const	{}		// once the loads are done
+
+	// Optional: load every file at once, before the per-file loads. Sets pLoaded[i] for
+	// the files it loaded, the others go through Load() on the pool
+	virtual	void	LoadBatch(CDirEntry * const * /*ppEntry*/,unsigned char * const * /*ppDst*/,char * /*pLoaded*/,int /*nbFile*/)	{}
+};
+
+// Host files are read in one batch when the host can (HostReadFiles)
+class CHostFileSource : public CFileSource
+{
+public:
+	virtual	bool	Load(const CDirEntry *pEntry,unsigned char *pDst,int worker);
+	virtual	void	LoadBatch(CDirEntry * const *ppEntry,unsigned char * const *ppDst,char *pLoaded,int nbFile);
+};
+
+// A ZIP file is mapped for the life of the source (read with stdio if it can't be):
+// members are inflated straight from the mapping
+class CZIPFileSource : public CFileSource
+{
+public:
+	CZIPFileSource(const char *pZIPName);
+	CZIPFileSource(const void *pZIPData,unsigned long size);		// archive in memory (kept by the caller)
+	virtual			~CZIPFileSource();
+	ZFILE		*	Open() const;			// new handle on the archive (to read its index)
+	virtual	void	SetNbWorker(int nbWorker);
+	virtual	bool	Load(const CDirEntry *pEntry,unsigned char *pDst,int worker);
+	virtual	void	AddStats(JobStats *pStats) const;
+
+private:
+	char					m_sZIPName[_MAX_PATH];
+	CMappedFile				m_map;
+	const void			*	m_pZIPData;
+	unsigned long			m_zipSize;
+	std::vector<ZFILE*>		m_handles;
+	std::vector<long long>	m_compressed;		// per worker, of the members read
+	std::vector<long long>	m_inflated;
+};
+
+// ZIP archive read in one pass from a stream that can't seek (stdin): every
+// member is inflated once while the tree is built, then copied to the image
+class CZIPStreamSource : public CFileSource
+{
+public:
+	virtual			~CZIPStreamSource();
+	CDirectory	*	Read(FILE *h,CArena *pArena);			// NULL if it is not a whole ZIP archive
+	virtual	bool	Load(const CDirEntry *pEntry,unsigned char *pDst,int worker);
+	virtual	void	AddStats(JobStats *pStats) const;
+
+private:
+	std::vector<unsigned char*>	m_data;				// by source index
+	long long					m_compressed;
+	long long					m_inflated;
+};
+
+// Files already in memory, by source index (the library API)
+class CMemoryFileSource : public CFileSource
+{
+public:
+	CMemoryFileSource(const void * const *ppData)	{ m_ppData = ppData; }
+	virtual	bool	Load(const CDirEntry *pEntry,unsigned char *pDst,int worker);
+
+private:
+	const void * const *	m_ppData;
+};
+
+// Console output of a build
+enum Verbosity
+{
+	VERBOSE_QUIET,			// nothing (batch jobs)
+	VERBOSE_NORMAL,			// steps and errors
+	VERBOSE_ENTRIES,		// and every directory entry (-v)
 };
 
 
@@ -88,37 +195,131 @@ public:
 	CFloppy();
 	~CFloppy();
 
-	bool			Create(int nbSide,int nbSectorPerTrack,int nbCylinder);
+	bool			Create(const DiskGeometry &geometry);
 	void			Destroy();
 
-	bool			Fill(CDirectory *pRoot);
-	bool			WriteImage(const char *pName);
+	bool			Fill(CDirectory *pRoot,const std::vector<CDirEntry*> *pOrder = NULL);
+	bool			LoadFiles(CFileSource *pSource,CThreadPool *pPool);		// pPool NULL: use a private one
+	// pPool NULL: pack on the calling thread. Unchanged tracks of pPrevious are not packed
+	// again; pResult gets what is needed for the next build (both optional)
+	bool			WriteMSA(const char *pName,CThreadPool *pPool,const CCacheEntry *pPrevious = NULL,CCacheEntry *pResult = NULL);
+	bool			WriteST(const char *pName);
+
+	// Same images in memory: PackMSA returns the size of GetMsaImage() (valid till the next
+	// build), CopyST fills GetRawSize() bytes
+	int				PackMSA(CThreadPool *pPool,const CCacheEntry *pPrevious = NULL,CCacheEntry *pResult = NULL);
+	const unsigned char	*	GetMsaImage() const		{ return m_pMsaImage; }
+	void			CopyST(unsigned char *pDst);
+	int				GetRawSize() const				{ return m_rawSize; }
+
+	void			SetVerbosity(int verbosity)		{ m_verbosity = verbosity; }
+	void			SetStats(JobStats *pStats)		{ m_pStats = pStats; }		// NULL: no counters
+	void			SetMaxFileTime(long long t);					// Unix time, later file dates are clamped to it (-1: none)
+	int				GetNbSeek() const				{ return m_nbSeek; }		// estimated by Fill
+	int				GetSeekDistance() const			{ return m_seekDistance; }
+
+	void			FAT_Flush();		// FAT to the image (done by the writers)
 
 private:
 
-	void			FAT_Flush();
-	bool			BuildDirectory(LFN *pLFN,CDirectory *pDir,int cluster,int parentCluster,int size,int level);
+	int				AllocClusters(int nbCluster,int nbSkip = 0);
+	bool			AllocTree(CDirectory *pDir);
+	bool			AllocDirectories(CDirectory *pDir);
+	bool			AllocInOrder(CDirectory *pRoot,const std::vector<CDirEntry*> &files);
+	int				TrackAlignSkip(int nbCluster,int nbSpare) const;
+	int				EstimateSeeks(const std::vector<CDirEntry*> &files,int *pDistance) const;
+	int				ClusterSector(int cluster) const	{ return 1 + m_sectorPerFat*2 + m_nbRootSector + (cluster-2)*2; }
+	void			BuildDirectory(LFN *pLFN,CDirectory *pDir,int cluster,int parentCluster,int size,int level);
 	unsigned char *	GetRawAd(int cluster);
+	unsigned char *	TouchRaw(unsigned char *p,int size);
 	void			w8(int offset,unsigned char d)		{ m_pRawImage[offset] = d; }
 	void			w16(int offset,unsigned short d)	{ m_pRawImage[offset] = d&0xff; m_pRawImage[offset+1] = (d>>8); }
 
 	int					m_nbSide;
 	int					m_nbCylinder;
 	int					m_nbSectorPerTrack;
+	int					m_nbRootEntry;
+	int					m_nbRootSector;
+	int					m_sectorPerFat;
 	int					m_rawSize;
+	int					m_rawCapacity;
 
 	CDirectory		*	m_pRoot;
 	unsigned char	*	m_pRawImage;
+	std::vector<char>	m_trackDirty;			// tracks written since Create (others are all 0xe5, not even initialized)
+	unsigned char	*	m_pMsaImage;
+	int					m_msaCapacity;
 
 	int					m_nbFreeCluster;
 	int					m_nextCluster;
 	int					m_maxFatEntry;
 	int					m_nbFatEntry;
 	int				*	m_pFat;
+	int					m_fatCapacity;
+	int					m_nbSeek;
+	int					m_seekDistance;
 
+	int					m_verbosity;
+	JobStats		*	m_pStats;
+	bool				m_bMaxFileTime;
+	FILETIME			m_maxFileTime;
 
 };
 
 
+// Floppies kept from one build to the next, so their buffers are only allocated once.
+// They are taken per job, not per worker: a worker waiting for the file loads of its
+// job may run another job meanwhile
+class CFloppyPool
+{
+public:
+	~CFloppyPool();
+
+	CFloppy	*	Take();
+	void		Give(CFloppy *pFloppy);
+
+private:
+	std::mutex				m_mutex;
+	std::vector<CFloppy*>	m_free;
+};
+
+
+// Output image formats. The writers are used after CFloppy::LoadFiles
+enum ImageFormat
+{
+	IMAGE_FORMAT_MSA,
+	IMAGE_FORMAT_ST,
+};
+
+ImageFormat		ImageFormatFromName(const char *pName);		// from the extension, MSA by default
+const char	*	ImageFormatExtension(ImageFormat format);	// ".msa" or ".st"
+
+class CImageWriter
+{
+public:
+	virtual			~CImageWriter()		{}
+	virtual	bool	Write(CFloppy &floppy,const char *pName,CThreadPool *pPool) = 0;
+
+	static	CImageWriter*	Create(ImageFormat format);
+};
+
+// Tracks packed in parallel. With cache entries, see CFloppy::WriteMSA
+class CMsaWriter : public CImageWriter
+{
+public:
+	CMsaWriter(const CCacheEntry *pPrevious = NULL,CCacheEntry *pResult = NULL)	{ m_pPrevious = pPrevious; m_pResult = pResult; }
+	virtual	bool	Write(CFloppy &floppy,const char *pName,CThreadPool *pPool);
+
+private:
+	const CCacheEntry	*	m_pPrevious;
+	CCacheEntry			*	m_pResult;
+};
+
+// Raw sectors, written from the image buffer to a mapped output file
+class CStWriter : public CImageWriter
+{
+public:
+	virtual	bool	Write(CFloppy &floppy,const char *pName,CThreadPool *pPool);
+};
 
 #endif // __DIR2FLOPPY__
\ No newline at end of file
@@ -0,0 +1,190 @@
+
+#include "Platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Dir2Floppy.h"
+#include "Dir2MsaLib.h"
+#include "ThreadPool.h"
+
+void	D2M_DefaultOptions(D2M_OPTIONS *pOptions)
+{
+	pOptions->format = D2M_FORMAT_MSA;
+	pOptions->smallest = 0;
+	pOptions->maxFileTime = -1;
+	pOptions->nbThread = 1;
+}
+
+const char	*	D2M_ErrorString(int error)
+{
+	switch (error)
+	{
+		case D2M_OK:						return "ok";
+		case D2M_ERROR_BAD_ARGUMENT:		return "bad argument";
+		case D2M_ERROR_BAD_INPUT:			return "not a ZIP file";
+		case D2M_ERROR_ROOT_FULL:			return "too much files in root directory";
+		case D2M_ERROR_NO_SPACE:			return "does not fit on the disk";
+		case D2M_ERROR_READ:				return "could not read a file";
+		case D2M_ERROR_BUFFER_TOO_SMALL:	return "image buffer too small";
+		case D2M_ERROR_OUT_OF_MEMORY:		return "out of memory";
+	}
+	return "unknown error";
+}
+
+void	D2M_FreeImage(D2M_IMAGE *pImage)
+{
+	if (pImage && pImage->allocated)
+	{
+		free(pImage->data);
+		pImage->data = NULL;
+		pImage->capacity = 0;
+		pImage->allocated = 0;
+	}
+}
+
+static	int		ReserveImage(D2M_IMAGE *pImage,size_t size)
+{
+	pImage->size = (unsigned long)size;
+	if (NULL == pImage->data)
+	{
+		pImage->data = (unsigned char*)malloc(size);
+		if (NULL == pImage->data)
+			return D2M_ERROR_OUT_OF_MEMORY;
+		pImage->capacity = (unsigned long)size;
+		pImage->allocated = 1;
+	}
+	else if (pImage->capacity < size)
+		return D2M_ERROR_BUFFER_TOO_SMALL;
+	return D2M_OK;
+}
+
+// Same steps as the command line build, the image goes to pImage
+static	int		BuildFromTree(CDirectory *pRoot,CFileSource *pSource,const D2M_OPTIONS &options,D2M_IMAGE *pImage)
+{
+	CCapacityPlan plan;
+	plan.Compute(pRoot);
+	const DiskGeometry *pGeometry = plan.SelectGeometry(0 != options.smallest);
+	if (NULL == pGeometry)
+	{
+		int nbGeometry;
+		const DiskGeometry &biggest = GetGeometryTable(&nbGeometry)[nbGeometry-1];
+		return (plan.GetNbRootEntry() > biggest.nbRootEntry) ? D2M_ERROR_ROOT_FULL : D2M_ERROR_NO_SPACE;
+	}
+
+	CFloppy floppy;
+	floppy.SetVerbosity(VERBOSE_QUIET);
+	floppy.SetMaxFileTime(options.maxFileTime);
+	if (!floppy.Create(*pGeometry))
+		return D2M_ERROR_OUT_OF_MEMORY;
+	if (!floppy.Fill(pRoot))
+		return D2M_ERROR_NO_SPACE;
+
+	CThreadPool pool(options.nbThread);
+	if (!floppy.LoadFiles(pSource,&pool))
+		return D2M_ERROR_READ;
+
+	if (D2M_FORMAT_ST == options.format)
+	{	// straight to the output
+		int rCode = ReserveImage(pImage,floppy.GetRawSize());
+		if (D2M_OK == rCode)
+			floppy.CopyST(pImage->data);
+		return rCode;
+	}
+
+	int size = floppy.PackMSA(&pool);
+	int rCode = ReserveImage(pImage,size);
+	if (D2M_OK == rCode)
+		memcpy(pImage->data,floppy.GetMsaImage(),size);
+	return rCode;
+}
+
+static	bool	CheckArguments(const D2M_OPTIONS *pOptions,D2M_IMAGE *pImage,D2M_OPTIONS *pResolved)
+{
+	if (NULL == pImage)
+		return false;
+	if (NULL == pImage->data)
+		pImage->capacity = 0;
+	pImage->size = 0;
+	pImage->allocated = 0;
+
+	if (pOptions)
+		*pResolved = *pOptions;
+	else
+		D2M_DefaultOptions(pResolved);
+	return ((D2M_FORMAT_MSA == pResolved->format) || (D2M_FORMAT_ST == pResolved->format)) && (pResolved->nbThread >= 0);
+}
+
+int		D2M_BuildFromFiles(const D2M_FILE *pFiles,int nbFile,const D2M_OPTIONS *pOptions,D2M_IMAGE *pImage)
+{
+	D2M_OPTIONS options;
+	if (!CheckArguments(pOptions,pImage,&options) || (nbFile < 0) || (nbFile && (NULL == pFiles)))
+		return D2M_ERROR_BAD_ARGUMENT;
+
+	try
+	{
+		// paths with '/' only, and no leading one
+		std::vector<std::string> names(nbFile);
+		std::vector<PathEntry> paths(nbFile);
+		std::vector<const void*> data(nbFile);
+		for (int i=0;i<nbFile;i++)
+		{
+			const D2M_FILE &file = pFiles[i];
+			if ((NULL == file.path) || (file.size && (NULL == file.data)))
+				return D2M_ERROR_BAD_ARGUMENT;
+
+			const char *pPath = file.path;
+			while (('/' == *pPath) || ('\\' == *pPath))
+				pPath++;
+			names[i] = pPath;
+			for (size_t c=0;c<names[i].size();c++)
+			{
+				if ('\\' == names[i][c])
+					names[i][c] = '/';
+			}
+
+			paths[i].pPath = names[i].c_str();
+			paths[i].size = (DWORD)file.size;
+			UnixTimeToFileTime(file.mtime,&paths[i].time);
+			data[i] = file.data;
+		}
+
+		CArena arena;
+		CDirectory *pRoot = CreateTreeFromPaths(paths.data(),nbFile,&arena);
+		CMemoryFileSource source(data.data());
+		return BuildFromTree(pRoot,&source,options,pImage);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return D2M_ERROR_OUT_OF_MEMORY;
+	}
+}
+
+int		D2M_BuildFromZIP(const void *pZIP,unsigned long size,const D2M_OPTIONS *pOptions,D2M_IMAGE *pImage)
+{
+	D2M_OPTIONS options;
+	if (!CheckArguments(pOptions,pImage,&options) || (NULL == pZIP))
+		return D2M_ERROR_BAD_ARGUMENT;
+
+	try
+	{
+		ZFILE *pFile = zopenmem(pZIP,size);
+		if (NULL == pFile)
+			return D2M_ERROR_OUT_OF_MEMORY;
+
+		CArena arena;
+		CDirectory *pRoot = zIsZIP(pFile) ? CreateTreeFromZIP(pFile,&arena) : NULL;
+		zclose(pFile);
+		if (NULL == pRoot)
+			return D2M_ERROR_BAD_INPUT;
+
+		CZIPFileSource source(pZIP,size);
+		return BuildFromTree(pRoot,&source,options,pImage);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return D2M_ERROR_OUT_OF_MEMORY;
+	}
+}
@@ -0,0 +1,75 @@
+
+#ifndef __DIR2MSALIB__
+#define __DIR2MSALIB__
+
+/*--------------------------------------------------------------------------
+ * dir2msa as a library: builds an MSA or ST image in memory, from a list of
+ * files in memory or from a ZIP archive in memory. Nothing is printed and no
+ * file is written. Every call has its own state: several images can be
+ * built at the same time from different threads.
+ *--------------------------------------------------------------------------*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum
+{
+	D2M_OK = 0,
+	D2M_ERROR_BAD_ARGUMENT,			/* NULL pointer, negative count...                */
+	D2M_ERROR_BAD_INPUT,			/* not a ZIP archive, or no central directory     */
+	D2M_ERROR_ROOT_FULL,			/* too many entries in the root directory          */
+	D2M_ERROR_NO_SPACE,				/* does not fit on the biggest known format        */
+	D2M_ERROR_READ,					/* a ZIP member could not be extracted (CRC...)    */
+	D2M_ERROR_BUFFER_TOO_SMALL,		/* image.size tells the size needed                */
+	D2M_ERROR_OUT_OF_MEMORY,
+};
+
+enum
+{
+	D2M_FORMAT_MSA = 0,
+	D2M_FORMAT_ST,					/* raw sectors */
+};
+
+typedef struct
+{
+	int				format;			/* D2M_FORMAT_xxx                                   */
+	int				smallest;		/* not 0: smallest format that fits (-s)            */
+	long long		maxFileTime;	/* Unix time, later file dates are clamped. -1: none */
+	int				nbThread;		/* to load files and pack tracks (0: one per core)  */
+} D2M_OPTIONS;
+
+typedef struct
+{
+	const char	*	path;			/* relative, '/' or '\' separated ("DATA/INTRO.PRG").
+									   A trailing separator makes an empty directory    */
+	const void	*	data;			/* size bytes, only read during the call            */
+	unsigned long	size;
+	long long		mtime;			/* Unix time                                        */
+} D2M_FILE;
+
+typedef struct
+{
+	unsigned char *	data;			/* in: caller buffer, or NULL to get a buffer       */
+									/* allocated by the library (see D2M_FreeImage)     */
+	unsigned long	capacity;		/* in: size of the caller buffer                    */
+	unsigned long	size;			/* out: image size (size needed if too small)       */
+	int				allocated;		/* out: data was allocated by the library           */
+} D2M_IMAGE;
+
+void			D2M_DefaultOptions(D2M_OPTIONS *pOptions);
+
+/* Both return D2M_OK or a D2M_ERROR_xxx code. pOptions may be NULL (defaults) */
+int				D2M_BuildFromFiles(const D2M_FILE *pFiles,int nbFile,const D2M_OPTIONS *pOptions,D2M_IMAGE *pImage);
+int				D2M_BuildFromZIP(const void *pZIP,unsigned long size,const D2M_OPTIONS *pOptions,D2M_IMAGE *pImage);
+
+/* Frees the data of a library allocated image (nothing for a caller buffer) */
+void			D2M_FreeImage(D2M_IMAGE *pImage);
+
+const char	*	D2M_ErrorString(int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DIR2MSALIB__ */
@@ -0,0 +1,121 @@
+
+#include "Dir2Floppy.h"
+#include "Geometry.h"
+
+static	const	int		ST_ROOT_ENTRY		=	112;
+static	const	int		ST_MIN_SECTOR_PER_FAT	=	5;		// what TOS writes, even when fewer would do
+
+static	const	DiskGeometry	s_geometries[] =
+{
+	{ 1,  9, 80, ST_ROOT_ENTRY },		// 360 KB
+	{ 1,  9, 81, ST_ROOT_ENTRY },
+	{ 1,  9, 82, ST_ROOT_ENTRY },
+	{ 1,  9, 83, ST_ROOT_ENTRY },
+	{ 1,  9, 84, ST_ROOT_ENTRY },
+	{ 1, 10, 80, ST_ROOT_ENTRY },		// 400 KB
+	{ 1, 10, 81, ST_ROOT_ENTRY },
+	{ 1, 10, 82, ST_ROOT_ENTRY },
+	{ 1, 10, 83, ST_ROOT_ENTRY },
+	{ 1, 10, 84, ST_ROOT_ENTRY },
+	{ 1, 11, 80, ST_ROOT_ENTRY },		// 440 KB
+	{ 1, 11, 81, ST_ROOT_ENTRY },
+	{ 1, 11, 82, ST_ROOT_ENTRY },
+	{ 1, 11, 83, ST_ROOT_ENTRY },
+	{ 1, 11, 84, ST_ROOT_ENTRY },
+	{ 2,  9, 80, ST_ROOT_ENTRY },		// 720 KB
+	{ 2,  9, 81, ST_ROOT_ENTRY },
+	{ 2,  9, 82, ST_ROOT_ENTRY },
+	{ 2,  9, 83, ST_ROOT_ENTRY },
+	{ 2,  9, 84, ST_ROOT_ENTRY },
+	{ 2, 10, 80, ST_ROOT_ENTRY },		// 800 KB
+	{ 2, 10, 81, ST_ROOT_ENTRY },		// default
+	{ 2, 10, 82, ST_ROOT_ENTRY },
+	{ 2, 10, 83, ST_ROOT_ENTRY },
+	{ 2, 10, 84, ST_ROOT_ENTRY },
+	{ 2, 11, 80, ST_ROOT_ENTRY },		// 880 KB
+	{ 2, 11, 81, ST_ROOT_ENTRY },
+	{ 2, 11, 82, ST_ROOT_ENTRY },
+	{ 2, 11, 83, ST_ROOT_ENTRY },
+	{ 2, 11, 84, ST_ROOT_ENTRY },		// 924 KB
+};
+
+static	const	int		DEFAULT_GEOMETRY	=	21;
+
+const DiskGeometry*	GetGeometryTable(int *pNbGeometry)
+{
+	*pNbGeometry = (int)(sizeof(s_geometries) / sizeof(s_geometries[0]));
+	return s_geometries;
+}
+
+const DiskGeometry&	GetDefaultGeometry()
+{
+	return s_geometries[DEFAULT_GEOMETRY];
+}
+
+// Smallest FAT holding an entry for every cluster (12 bits each, clusters start at 2).
+// Growing the FAT eats data sectors, so iterate until it's stable
+int		DiskGeometry::GetSectorPerFat() const
+{
+	int sectorPerFat = ST_MIN_SECTOR_PER_FAT;
+	for (;;)
+	{
+		int nbCluster = (GetNbSector() - 1 - 2 * sectorPerFat - GetNbRootSector()) / 2;
+		if ((nbCluster + 2) * 3 <= sectorPerFat * 512 * 2)
+			return sectorPerFat;
+		sectorPerFat++;
+	}
+}
+
+
+CCapacityPlan::CCapacityPlan()
+{
+	m_nbFileCluster = 0;
+	m_nbDirCluster = 0;
+	m_nbRootEntry = 0;
+}
+
+// Same rules as CFloppy::BuildDirectory
+void	CCapacityPlan::AddDirectory(const CDirectory *pDir)
+{
+	for (int i=0;i<pDir->GetNbEntry();i++)
+	{
+		const CDirEntry *pEntry = pDir->GetEntry(i);
+		const CDirectory *pSubDir = pEntry->GetDirectory();
+		if (pSubDir)
+		{
+			m_nbDirCluster += (((pSubDir->GetNbEntry()+2)*32)+1023)/1024;		// "." and ".." entries
+			AddDirectory(pSubDir);
+		}
+		else
+			m_nbFileCluster += (pEntry->GetSize()+1023)/1024;
+	}
+}
+
+void	CCapacityPlan::Compute(const CDirectory *pRoot)
+{
+	m_nbFileCluster = 0;
+	m_nbDirCluster = 0;
+	m_nbRootEntry = pRoot->GetNbEntry() + 1;
+	AddDirectory(pRoot);
+}
+
+bool	CCapacityPlan::Fits(const DiskGeometry &geometry,int *pFreeCluster) const
+{
+	long long nbFree = geometry.GetNbCluster() - GetNbCluster();
+	if (pFreeCluster)
+		*pFreeCluster = (nbFree < -0x7fffffff) ? -0x7fffffff : (int)nbFree;
+	return (nbFree >= 0) && (m_nbRootEntry <= geometry.nbRootEntry);
+}
+
+const DiskGeometry*	CCapacityPlan::SelectGeometry(bool bSmallest) const
+{
+	int nbGeometry;
+	const DiskGeometry *pTable = GetGeometryTable(&nbGeometry);
+	int minSector = bSmallest ? 0 : GetDefaultGeometry().GetNbSector();
+	for (int i=0;i<nbGeometry;i++)
+	{
+		if ((pTable[i].GetNbSector() >= minSector) && Fits(pTable[i]))
+			return pTable + i;
+	}
+	return NULL;
+}
@@ -0,0 +1,59 @@
+
+#ifndef __GEOMETRY__
+#define __GEOMETRY__
+
+class CDirectory;
+
+//--------------------------------------------------------------------------
+// Atari ST floppy formats. Clusters are always 2 sectors (1 KB), and there
+// are two FATs; the FAT size is derived from the number of clusters.
+//--------------------------------------------------------------------------
+struct DiskGeometry
+{
+	int		nbSide;
+	int		nbSectorPerTrack;
+	int		nbCylinder;
+	int		nbRootEntry;
+
+	int		GetNbSector() const			{ return nbSide * nbSectorPerTrack * nbCylinder; }
+	int		GetNbRootSector() const		{ return (nbRootEntry * 32 + 511) / 512; }
+	int		GetSectorPerFat() const;
+	int		GetFirstDataSector() const	{ return 1 + 2 * GetSectorPerFat() + GetNbRootSector(); }
+	int		GetNbCluster() const		{ return (GetNbSector() - GetFirstDataSector()) / 2; }
+};
+
+// Known formats, smallest first
+const DiskGeometry*	GetGeometryTable(int *pNbGeometry);
+
+// The usual dir2msa image (2 sides, 81 cylinders, 10 sectors per track)
+const DiskGeometry&	GetDefaultGeometry();
+
+// What a tree needs on disk, computed once from the entries (sizes and counts only).
+// Fits() then answers for any geometry without building anything.
+class CCapacityPlan
+{
+public:
+	CCapacityPlan();
+
+	void	Compute(const CDirectory *pRoot);
+
+	// pFreeCluster (optional) gets the clusters left, negative when it doesn't fit
+	bool	Fits(const DiskGeometry &geometry,int *pFreeCluster = NULL) const;
+
+	// Smallest known geometry that fits, NULL if none. Unless bSmallest, formats smaller
+	// than the default one are not used
+	const DiskGeometry*	SelectGeometry(bool bSmallest) const;
+
+	long long	GetNbCluster() const		{ return m_nbFileCluster + m_nbDirCluster; }
+	long long	GetNbDirCluster() const		{ return m_nbDirCluster; }
+	int			GetNbRootEntry() const		{ return m_nbRootEntry; }
+
+private:
+	void	AddDirectory(const CDirectory *pDir);
+
+	long long	m_nbFileCluster;
+	long long	m_nbDirCluster;
+	int			m_nbRootEntry;			// volume name included
+};
+
+#endif // __GEOMETRY__
@@ -0,0 +1,153 @@
+
+#include <stdio.h>
+#include <string.h>
+#include "Platform.h"
+#include "ImageCache.h"
+
+static	const	char			CACHE_MAGIC[4]	=	{ 'D','2','M','C' };
+static	const	unsigned int	CACHE_VERSION	=	1;
+
+struct CacheHeader
+{
+	char			magic[4];
+	unsigned int	version;
+	HASH64			manifest;
+	int				rawSize;
+	int				nbTrack;
+	int				msaSize;
+};
+
+static	const	HASH64	K1	=	0x87c37b91114253d5ULL;
+static	const	HASH64	K2	=	0x4cf5ad432745937fULL;
+
+static	inline	HASH64	Rotl64(HASH64 v,int n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+static	inline	HASH64	Mix(HASH64 h,HASH64 w)
+{
+	w *= K1;
+	w = Rotl64(w,31);
+	w *= K2;
+	h ^= w;
+	return Rotl64(h,27) * 5 + 0x52dce729;
+}
+
+// MurmurHash3 style: one 64 bits lane, 8 bytes per step
+HASH64	HashBlock(const void *pData,size_t size,HASH64 seed)
+{
+	const unsigned char *p = (const unsigned char*)pData;
+	HASH64 h = seed ^ (size * K2);
+
+	size_t n = size & ~(size_t)7;
+	for (size_t i=0;i<n;i+=8)
+	{
+		HASH64 w;
+		memcpy(&w,p + i,8);
+		h = Mix(h,w);
+	}
+	if (size & 7)
+	{
+		HASH64 w = 0;
+		memcpy(&w,p + n,size & 7);
+		h = Mix(h,w);
+	}
+
+	// final avalanche
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h ? h : 1;
+}
+
+void	CHash64::AddString(const char *pStr)
+{
+	Add(pStr,strlen(pStr) + 1);
+}
+
+
+CCacheEntry::CCacheEntry()
+{
+	m_manifest = 0;
+	m_rawSize = 0;
+}
+
+bool	CCacheEntry::Load(const char *pName)
+{
+	CMappedFile file;
+	if (!file.Open(pName))
+		return false;
+
+	CacheHeader header;
+	if (file.GetSize() < sizeof(header))
+		return false;
+	memcpy(&header,file.GetData(),sizeof(header));
+	if ((0 != memcmp(header.magic,CACHE_MAGIC,4)) || (CACHE_VERSION != header.version) ||
+		(header.nbTrack < 0) || (header.msaSize < 0) || (header.rawSize <= 0))
+		return false;
+
+	size_t tracksSize = header.nbTrack * sizeof(MsaTrackInfo);
+	if (file.GetSize() != sizeof(header) + tracksSize + header.msaSize)
+		return false;
+
+	m_manifest = header.manifest;
+	m_rawSize = header.rawSize;
+	m_tracks.resize(header.nbTrack);
+	if (tracksSize)
+		memcpy(m_tracks.data(),file.GetData() + sizeof(header),tracksSize);
+	m_msa.assign(file.GetData() + sizeof(header) + tracksSize,file.GetData() + file.GetSize());
+
+	for (size_t i=0;i<m_tracks.size();i++)
+	{
+		const MsaTrackInfo &track = m_tracks[i];
+		if ((track.offset < 0) || (track.size < 0) || (track.offset + track.size > header.msaSize))
+			return false;
+	}
+	return true;
+}
+
+bool	CCacheEntry::Save(const char *pName) const
+{
+	CacheHeader header;
+	memcpy(header.magic,CACHE_MAGIC,4);
+	header.version = CACHE_VERSION;
+	header.manifest = m_manifest;
+	header.rawSize = m_rawSize;
+	header.nbTrack = (int)m_tracks.size();
+	header.msaSize = (int)m_msa.size();
+
+	char sTmpName[_MAX_PATH];
+	snprintf(sTmpName,sizeof(sTmpName),"%s.tmp",pName);
+	FILE *h = fopen(sTmpName,"wb");
+	if (NULL == h)
+		return false;
+
+	bool bOk = (1 == fwrite(&header,sizeof(header),1,h));
+	if (bOk && !m_tracks.empty())
+		bOk = (m_tracks.size() == fwrite(m_tracks.data(),sizeof(MsaTrackInfo),m_tracks.size(),h));
+	if (bOk && !m_msa.empty())
+		bOk = (m_msa.size() == fwrite(m_msa.data(),1,m_msa.size(),h));
+	if ((0 != fclose(h)) || !bOk || !HostReplaceFile(sTmpName,pName))
+	{
+		remove(sTmpName);
+		return false;
+	}
+	return true;
+}
+
+const unsigned char	*	CCacheEntry::FindTrack(int t,int rawSize,HASH64 hash,int *pSize) const
+{
+	if ((rawSize != m_rawSize) || (t >= (int)m_tracks.size()) || (hash != m_tracks[t].hash))
+		return NULL;
+	*pSize = m_tracks[t].size;
+	return m_msa.data() + m_tracks[t].offset;
+}
+
+void	CacheEntryName(const char *pCacheDir,const char *pImageName,char *sEntryName)
+{
+	HASH64 key = HashBlock(pImageName,strlen(pImageName));
+	snprintf(sEntryName,_MAX_PATH,"%s/%016llx.d2c",pCacheDir,key);
+}
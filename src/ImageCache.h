@@ -0,0 +1,63 @@
+
+#ifndef __IMAGECACHE__
+#define __IMAGECACHE__
+
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Incremental build cache.
+// An entry is kept per output image: the hash of the input manifest (names,
+// sizes, dates or ZIP CRCs, and geometry), and the .msa written from it with
+// the hash of every raw track. When the manifest did not change the .msa is
+// reused as is; otherwise the image is built again but only the tracks whose
+// raw content changed are packed again.
+// Entries are host specific (native byte order).
+//--------------------------------------------------------------------------
+
+typedef	unsigned long long	HASH64;
+
+// Non cryptographic 64 bits hash, never 0
+HASH64	HashBlock(const void *pData,size_t size,HASH64 seed = 0);
+
+// Incremental hash of a sequence of values (the manifest)
+class CHash64
+{
+public:
+	CHash64()								{ m_hash = 0; }
+	void	Add(const void *pData,size_t size)	{ m_hash = HashBlock(pData,size,m_hash); }
+	void	AddInt(long long v)				{ Add(&v,sizeof(v)); }
+	void	AddString(const char *pStr);
+	HASH64	Get() const						{ return m_hash; }
+
+private:
+	HASH64	m_hash;
+};
+
+struct MsaTrackInfo
+{
+	HASH64	hash;				// of the raw track, 0 for a blank (never written) track
+	int		offset;				// of the packed track (length word included) in the .msa
+	int		size;
+};
+
+class CCacheEntry
+{
+public:
+	CCacheEntry();
+
+	bool	Load(const char *pName);
+	bool	Save(const char *pName) const;		// atomic (written aside, then renamed)
+
+	// Packed track t of this entry if its raw content hash is the same, NULL otherwise
+	const unsigned char	*	FindTrack(int t,int rawSize,HASH64 hash,int *pSize) const;
+
+	HASH64						m_manifest;
+	int							m_rawSize;
+	std::vector<MsaTrackInfo>	m_tracks;
+	std::vector<unsigned char>	m_msa;		// the whole .msa file
+};
+
+// Entry file of an output image in the cache directory
+void	CacheEntryName(const char *pCacheDir,const char *pImageName,char *sEntryName);
+
+#endif // __IMAGECACHE__
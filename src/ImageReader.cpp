@@ -0,0 +1,333 @@
+
+#include <string.h>
+#include "ImageReader.h"
+#include "Msa.h"
+
+static	const	int		SECTOR_SIZE			=	512;
+static	const	int		MAX_DIR_LEVEL		=	32;		// corrupted images may loop
+
+static	int		r16le(const unsigned char *p)	{ return p[0] | (p[1]<<8); }
+static	int		r16be(const unsigned char *p)	{ return (p[0]<<8) | p[1]; }
+
+
+CImageReader::CImageReader()
+{
+	Close();
+}
+
+void	CImageReader::Close()
+{
+	m_file.Close();
+	m_bMSA = false;
+	m_nbSide = 0;
+	m_nbCylinder = 0;
+	m_nbSectorPerTrack = 0;
+	m_nbSector = 0;
+	m_firstTrack = 0;
+	m_trackOffset.clear();
+	m_trackSize.clear();
+	m_trackState.clear();
+	m_raw.clear();
+	m_nbUnpackedTrack = 0;
+	m_fat.clear();
+}
+
+bool	CImageReader::Open(const char *pName)
+{
+	Close();
+	if (!m_file.Open(pName))
+		return false;
+
+	const unsigned char *pData = m_file.GetData();
+	if ((m_file.GetSize() >= 10) && (0x0e == pData[0]) && (0x0f == pData[1]))
+	{
+		if (!OpenMSA())
+		{
+			Close();
+			return false;
+		}
+	}
+	else
+	{	// raw .st: the geometry is in the boot sector
+		if ((m_file.GetSize() < SECTOR_SIZE) || (m_file.GetSize() % SECTOR_SIZE))
+		{
+			Close();
+			return false;
+		}
+		m_nbSectorPerTrack = r16le(pData + 0x18);
+		m_nbSide = r16le(pData + 0x1a);
+		m_nbSector = (int)(m_file.GetSize() / SECTOR_SIZE);
+		if ((m_nbSectorPerTrack <= 0) || (m_nbSide <= 0) || (m_nbSide > 2))
+		{
+			Close();
+			return false;
+		}
+		m_nbCylinder = m_nbSector / (m_nbSectorPerTrack * m_nbSide);
+	}
+
+	if (!ParseBootSector() || !LoadFat())
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+// Only walks the track lengths: tracks are unpacked by GetSector
+bool	CImageReader::OpenMSA()
+{
+	const unsigned char *pData = m_file.GetData();
+	size_t size = m_file.GetSize();
+
+	m_bMSA = true;
+	m_nbSectorPerTrack = r16be(pData + 2);
+	m_nbSide = r16be(pData + 4) + 1;
+	m_firstTrack = r16be(pData + 6);
+	int lastTrack = r16be(pData + 8);
+	if ((m_nbSectorPerTrack <= 0) || (m_nbSectorPerTrack > 64) || (m_nbSide > 2) || (lastTrack < m_firstTrack) || (lastTrack > 255))
+		return false;
+
+	m_nbCylinder = lastTrack + 1;
+	m_nbSector = m_nbCylinder * m_nbSide * m_nbSectorPerTrack;
+
+	int nbTrack = m_nbCylinder * m_nbSide;
+	m_trackOffset.resize(nbTrack,0);
+	m_trackSize.resize(nbTrack,0);
+	m_trackState.resize(nbTrack,-1);		// tracks before the first one are not in the file
+
+	size_t offset = 10;
+	for (int t=m_firstTrack*m_nbSide;t<nbTrack;t++)
+	{
+		if (offset + 2 > size)
+			return false;
+		int packedSize = r16be(pData + offset);
+		offset += 2;
+		if (offset + packedSize > size)
+			return false;
+		m_trackOffset[t] = offset;
+		m_trackSize[t] = packedSize;
+		m_trackState[t] = 0;
+		offset += packedSize;
+	}
+
+	m_raw.resize((size_t)m_nbSector * SECTOR_SIZE);
+	return true;
+}
+
+const unsigned char	*	CImageReader::GetSector(int sector)
+{
+	if ((sector < 0) || (sector >= m_nbSector))
+		return NULL;
+
+	if (!m_bMSA)
+		return m_file.GetData() + (size_t)sector * SECTOR_SIZE;
+
+	int track = sector / m_nbSectorPerTrack;
+	int rawSize = m_nbSectorPerTrack * SECTOR_SIZE;
+	unsigned char *pTrack = &m_raw[(size_t)track * rawSize];
+	if (0 == m_trackState[track])
+	{
+		bool bOk = MsaUnpackTrack(m_file.GetData() + m_trackOffset[track],m_trackSize[track],pTrack,rawSize);
+		m_trackState[track] = bOk ? 1 : -1;
+		m_nbUnpackedTrack++;
+	}
+	if (m_trackState[track] < 0)
+		return NULL;
+
+	return pTrack + (sector % m_nbSectorPerTrack) * SECTOR_SIZE;
+}
+
+bool	CImageReader::ParseBootSector()
+{
+	const unsigned char *pBoot = GetSector(0);
+	if (NULL == pBoot)
+		return false;
+
+	if (SECTOR_SIZE != r16le(pBoot + 0xb))
+		return false;
+
+	m_sectorPerCluster = pBoot[0xd];
+	m_fatStart = r16le(pBoot + 0xe);
+	int nbFat = pBoot[0x10];
+	m_nbRootEntry = r16le(pBoot + 0x11);
+	m_sectorPerFat = r16le(pBoot + 0x16);
+	if ((m_sectorPerCluster <= 0) || (nbFat <= 0) || (m_nbRootEntry <= 0) || (m_sectorPerFat <= 0))
+		return false;
+
+	m_rootStart = m_fatStart + nbFat * m_sectorPerFat;
+	m_dataStart = m_rootStart + (m_nbRootEntry * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+	int nbSector = r16le(pBoot + 0x13);
+	if ((nbSector <= 0) || (nbSector > m_nbSector))
+		nbSector = m_nbSector;
+	if (nbSector <= m_dataStart)
+		return false;
+
+	m_nbCluster = (nbSector - m_dataStart) / m_sectorPerCluster;
+	return true;
+}
+
+bool	CImageReader::LoadFat()
+{
+	std::vector<unsigned char> fat(m_sectorPerFat * SECTOR_SIZE);
+	for (int i=0;i<m_sectorPerFat;i++)
+	{
+		const unsigned char *pSector = GetSector(m_fatStart + i);
+		if (NULL == pSector)
+			return false;
+		memcpy(&fat[i * SECTOR_SIZE],pSector,SECTOR_SIZE);
+	}
+
+	int nbEntry = m_nbCluster + 2;
+	if (nbEntry * 3 / 2 + 1 >= (int)fat.size())
+		nbEntry = ((int)fat.size() - 1) * 2 / 3;
+
+	m_fat.resize(nbEntry);
+	for (int i=0;i<nbEntry;i++)
+	{
+		const unsigned char *p = &fat[i * 3 / 2];
+		if (i & 1)
+			m_fat[i] = (p[0]>>4) | (p[1]<<4);
+		else
+			m_fat[i] = p[0] | ((p[1]&0xf)<<8);
+	}
+	return true;
+}
+
+// -1: end of chain, -2: bad link
+int		CImageReader::NextCluster(int cluster) const
+{
+	int next = m_fat[cluster];
+	if (next >= 0xff8)
+		return -1;
+	if ((next < 2) || (next >= (int)m_fat.size()))
+		return -2;
+	return next;
+}
+
+bool	CImageReader::ReadChain(int cluster,std::vector<unsigned char> &data)
+{
+	int clusterSize = m_sectorPerCluster * SECTOR_SIZE;
+	data.clear();
+	for (int n=0;cluster >= 0;n++)
+	{
+		if ((cluster < 2) || (cluster >= (int)m_fat.size()) || (n >= m_nbCluster))
+			return false;
+		size_t offset = data.size();
+		data.resize(offset + clusterSize);
+		for (int i=0;i<m_sectorPerCluster;i++)
+		{
+			const unsigned char *pSector = GetSector(m_dataStart + (cluster-2) * m_sectorPerCluster + i);
+			if (NULL == pSector)
+				return false;
+			memcpy(&data[offset + i * SECTOR_SIZE],pSector,SECTOR_SIZE);
+		}
+		cluster = NextCluster(cluster);
+		if (-2 == cluster)
+			return false;
+	}
+	return true;
+}
+
+static	void	EntryName(const unsigned char *pEntry,char *sName)
+{
+	int len = 8;
+	while ((len > 0) && (' ' == pEntry[len-1]))
+		len--;
+	memcpy(sName,pEntry,len);
+	sName[len] = 0;
+
+	int extLen = 3;
+	while ((extLen > 0) && (' ' == pEntry[8+extLen-1]))
+		extLen--;
+	if (extLen > 0)
+	{
+		sName[len] = '.';
+		memcpy(sName + len + 1,pEntry + 8,extLen);
+		sName[len + 1 + extLen] = 0;
+	}
+}
+
+bool	CImageReader::ListDirectory(const unsigned char *pDir,int nbEntry,const std::string &path,std::vector<ImageFileInfo> &files,int level)
+{
+	if (level > MAX_DIR_LEVEL)
+		return false;
+
+	for (int i=0;i<nbEntry;i++)
+	{
+		const unsigned char *pEntry = pDir + i * 32;
+		if (0 == pEntry[0])
+			break;					// end of directory
+		unsigned char attrib = pEntry[11];
+		if ((0xe5 == pEntry[0]) || (attrib & 0x08))
+			continue;				// deleted, volume name (or a VFAT long name)
+
+		char sName[8+1+3+1];
+		EntryName(pEntry,sName);
+		if ((0 == sName[0]) || (0 == strcmp(sName,".")) || (0 == strcmp(sName,"..")) || strpbrk(sName,"/\\:"))
+			continue;
+
+		ImageFileInfo info;
+		info.path = path.empty() ? sName : path + "/" + sName;
+		info.attrib = attrib;
+		info.updateTime = (unsigned short)r16le(pEntry + 22);
+		info.updateDate = (unsigned short)r16le(pEntry + 24);
+		info.firstCluster = r16le(pEntry + 26);
+		info.size = (int)(pEntry[28] | (pEntry[29]<<8) | (pEntry[30]<<16) | ((unsigned int)pEntry[31]<<24));
+		if (info.IsDirectory())
+			info.size = 0;
+		else if (info.size < 0)
+			return false;
+		files.push_back(info);
+
+		if (info.IsDirectory())
+		{
+			std::vector<unsigned char> subDir;
+			if (!ReadChain(info.firstCluster,subDir))
+				return false;
+			if (!ListDirectory(subDir.data(),(int)subDir.size() / 32,info.path,files,level+1))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool	CImageReader::ListFiles(std::vector<ImageFileInfo> &files)
+{
+	files.clear();
+
+	int nbSector = (m_nbRootEntry * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	std::vector<unsigned char> root(nbSector * SECTOR_SIZE);
+	for (int i=0;i<nbSector;i++)
+	{
+		const unsigned char *pSector = GetSector(m_rootStart + i);
+		if (NULL == pSector)
+			return false;
+		memcpy(&root[i * SECTOR_SIZE],pSector,SECTOR_SIZE);
+	}
+	return ListDirectory(root.data(),m_nbRootEntry,std::string(),files,0);
+}
+
+bool	CImageReader::ReadFile(const ImageFileInfo &file,unsigned char *pDst)
+{
+	int todo = file.size;
+	int cluster = file.firstCluster;
+	for (int n=0;todo > 0;n++)
+	{
+		if ((cluster < 2) || (cluster >= (int)m_fat.size()) || (n >= m_nbCluster))
+			return false;
+		for (int i=0;(i<m_sectorPerCluster) && (todo > 0);i++)
+		{
+			const unsigned char *pSector = GetSector(m_dataStart + (cluster-2) * m_sectorPerCluster + i);
+			if (NULL == pSector)
+				return false;
+			int size = (todo < SECTOR_SIZE) ? todo : SECTOR_SIZE;
+			memcpy(pDst,pSector,size);
+			pDst += size;
+			todo -= size;
+		}
+		if (todo > 0)
+			cluster = NextCluster(cluster);
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+
+#ifndef __IMAGEREADER__
+#define __IMAGEREADER__
+
+#include <string>
+#include <vector>
+#include "Platform.h"
+
+//--------------------------------------------------------------------------
+// Atari ST floppy image reader (.msa or raw .st), the way back from CFloppy.
+// The image file is mapped. MSA tracks are only unpacked when one of their
+// sectors is read, so listing an image touches the boot sector, FAT and
+// directory tracks only.
+// A reader is not thread safe: use one per thread.
+//--------------------------------------------------------------------------
+
+struct ImageFileInfo
+{
+	std::string		path;			// from the root, '/' separated
+	unsigned char	attrib;
+	int				size;
+	int				firstCluster;
+	unsigned short	updateDate;
+	unsigned short	updateTime;
+
+	bool	IsDirectory() const		{ return 0 != (attrib & 0x10); }
+};
+
+class CImageReader
+{
+public:
+	CImageReader();
+
+	bool	Open(const char *pName);
+	void	Close();
+
+	bool	IsMSA() const					{ return m_bMSA; }
+	int		GetNbSide() const				{ return m_nbSide; }
+	int		GetNbCylinder() const			{ return m_nbCylinder; }
+	int		GetNbSectorPerTrack() const		{ return m_nbSectorPerTrack; }
+	int		GetNbUnpackedTrack() const		{ return m_nbUnpackedTrack; }
+
+	// NULL when the sector is not in the image or its track is corrupted
+	const unsigned char	*	GetSector(int sector);
+
+	// Every file and directory, each directory before its content
+	bool	ListFiles(std::vector<ImageFileInfo> &files);
+
+	// Exactly file.size bytes
+	bool	ReadFile(const ImageFileInfo &file,unsigned char *pDst);
+
+private:
+	bool	OpenMSA();
+	bool	ParseBootSector();
+	bool	LoadFat();
+	int		NextCluster(int cluster) const;
+	bool	ReadChain(int cluster,std::vector<unsigned char> &data);
+	bool	ListDirectory(const unsigned char *pDir,int nbEntry,const std::string &path,std::vector<ImageFileInfo> &files,int level);
+
+	CMappedFile				m_file;
+	bool					m_bMSA;
+	int						m_nbSide;
+	int						m_nbCylinder;
+	int						m_nbSectorPerTrack;
+	int						m_nbSector;
+
+	// MSA only: where each packed track is, and the tracks unpacked so far
+	int						m_firstTrack;
+	std::vector<size_t>		m_trackOffset;
+	std::vector<int>		m_trackSize;
+	std::vector<char>		m_trackState;		// 0: not unpacked yet, 1: ok, -1: corrupted
+	std::vector<unsigned char>	m_raw;
+	int						m_nbUnpackedTrack;
+
+	// FAT12 layout, from the boot sector
+	int						m_sectorPerCluster;
+	int						m_fatStart;
+	int						m_sectorPerFat;
+	int						m_rootStart;
+	int						m_nbRootEntry;
+	int						m_dataStart;
+	int						m_nbCluster;
+	std::vector<unsigned short>	m_fat;
+};
+
+#endif // __IMAGEREADER__
@@ -0,0 +1,166 @@
+
+#include <string.h>
+#include "Msa.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define	MSA_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+static	const	unsigned char	MSA_RECORD		=	0xe5;
+static	const	int				MSA_MIN_RUN		=	5;		// shorter runs are cheaper as literals
+
+#ifdef MSA_SSE2
+static	inline	int		FirstBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index,mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// First position that must start a record: a 0xe5 byte or a run of MSA_MIN_RUN bytes.
+// Everything before it is stored as is.
+static	const unsigned char *	FindRecord(const unsigned char *p,const unsigned char *pEnd)
+{
+#ifdef MSA_SSE2
+	const __m128i e5 = _mm_set1_epi8((char)MSA_RECORD);
+	while (pEnd - p >= 16 + MSA_MIN_RUN - 1)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i*)p);
+		__m128i r01 = _mm_cmpeq_epi8(v0,_mm_loadu_si128((const __m128i*)(p+1)));
+		__m128i r02 = _mm_cmpeq_epi8(v0,_mm_loadu_si128((const __m128i*)(p+2)));
+		__m128i r03 = _mm_cmpeq_epi8(v0,_mm_loadu_si128((const __m128i*)(p+3)));
+		__m128i r04 = _mm_cmpeq_epi8(v0,_mm_loadu_si128((const __m128i*)(p+4)));
+		__m128i run = _mm_and_si128(_mm_and_si128(r01,r02),_mm_and_si128(r03,r04));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(run,_mm_cmpeq_epi8(v0,e5)));
+		if (mask)
+			return p + FirstBit(mask);
+		p += 16;
+	}
+#endif
+	for (;p < pEnd;p++)
+	{
+		if (MSA_RECORD == *p)
+			return p;
+		if ((pEnd - p >= MSA_MIN_RUN) && (p[1] == *p) && (p[2] == *p) && (p[3] == *p) && (p[4] == *p))
+			return p;
+	}
+	return pEnd;
+}
+
+static	int		RunLength(const unsigned char *p,const unsigned char *pEnd)
+{
+	const unsigned char *pStart = p;
+	unsigned char data = *p;
+#ifdef MSA_SSE2
+	const __m128i d = _mm_set1_epi8((char)data);
+	while (pEnd - p >= 16)
+	{
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p),d));
+		if (mask != 0xffff)
+			return (int)(p - pStart) + FirstBit(~mask);
+		p += 16;
+	}
+#endif
+	while ((p < pEnd) && (*p == data))
+		p++;
+	return (int)(p - pStart);
+}
+
+// Same output as the original byte per byte packer, but gives up as soon as the
+// packed size reaches the raw one (the raw track is stored then anyway)
+int		MsaPackTrack(const unsigned char *pSrc,int rawSize,unsigned char *pDst)
+{
+	const unsigned char *p = pSrc;
+	const unsigned char *pEnd = pSrc + rawSize;
+	unsigned char *pOut = pDst + 2;
+	unsigned char *pLimit = pOut + rawSize;
+
+	while (p < pEnd)
+	{
+		const unsigned char *pRecord = FindRecord(p,pEnd);
+		size_t nLiteral = pRecord - p;
+		if (nLiteral >= (size_t)(pLimit - pOut))
+			break;
+		memcpy(pOut,p,nLiteral);
+		pOut += nLiteral;
+		p = pRecord;
+
+		if (p < pEnd)
+		{
+			if (pLimit - pOut <= 4)
+				break;
+			int nRepeat = RunLength(p,pEnd);
+			*pOut++ = MSA_RECORD;
+			*pOut++ = *p;
+			*pOut++ = (nRepeat>>8)&255;
+			*pOut++ = (nRepeat&255);
+			p += nRepeat;
+		}
+	}
+
+	int size = rawSize;
+	if (p < pEnd)
+		memcpy(pDst + 2,pSrc,rawSize);
+	else
+		size = (int)(pOut - (pDst + 2));
+
+	pDst[0] = (size>>8)&255;
+	pDst[1] = size&255;
+	return 2 + size;
+}
+
+int		MsaPackBlankTrack(int rawSize,unsigned char *pDst)
+{
+	static const unsigned char record[6] = { 0, 4, MSA_RECORD, MSA_RECORD, 0, 0 };
+	memcpy(pDst,record,sizeof(record));
+	pDst[4] = (rawSize>>8)&255;
+	pDst[5] = rawSize&255;
+	return sizeof(record);
+}
+
+bool	MsaUnpackTrack(const unsigned char *pSrc,int packedSize,unsigned char *pDst,int rawSize)
+{
+	if (packedSize == rawSize)
+	{	// stored
+		memcpy(pDst,pSrc,rawSize);
+		return true;
+	}
+
+	const unsigned char *pEnd = pSrc + packedSize;
+	unsigned char *pOut = pDst;
+	unsigned char *pOutEnd = pDst + rawSize;
+	while (pSrc < pEnd)
+	{
+		const unsigned char *pRecord = (const unsigned char*)memchr(pSrc,MSA_RECORD,pEnd - pSrc);
+		if (NULL == pRecord)
+			pRecord = pEnd;
+		size_t nLiteral = pRecord - pSrc;
+		if (nLiteral > (size_t)(pOutEnd - pOut))
+			return false;
+		memcpy(pOut,pSrc,nLiteral);
+		pOut += nLiteral;
+		pSrc = pRecord;
+
+		if (pSrc < pEnd)
+		{
+			if (pEnd - pSrc < 4)
+				return false;
+			int nRepeat = (pSrc[2]<<8) | pSrc[3];
+			if (nRepeat > pOutEnd - pOut)
+				return false;
+			memset(pOut,pSrc[1],nRepeat);
+			pOut += nRepeat;
+			pSrc += 4;
+		}
+	}
+	return (pOut == pOutEnd);
+}
@@ -0,0 +1,25 @@
+
+#ifndef __MSA__
+#define __MSA__
+
+//--------------------------------------------------------------------------
+// MSA track packing.
+// A packed track is a big endian 16 bits length followed by the data. Inside,
+// 0xe5 starts a record: 0xe5, byte, big endian 16 bits count. Runs of 5 bytes
+// or more (and every 0xe5) are stored as records, anything else as is. When
+// packing does not save anything the raw track is stored instead.
+//--------------------------------------------------------------------------
+
+// Worst case size of MsaPackTrack output
+inline	int		MsaTrackSlotSize(int rawSize)		{ return 2 + rawSize; }
+
+// Pack one track to pDst (length word included), returns the written size
+int		MsaPackTrack(const unsigned char *pSrc,int rawSize,unsigned char *pDst);
+
+// Same as MsaPackTrack on a track full of 0xe5 (an unused one), without reading it
+int		MsaPackBlankTrack(int rawSize,unsigned char *pDst);
+
+// Unpack the packedSize bytes following a length word to exactly rawSize bytes
+bool	MsaUnpackTrack(const unsigned char *pSrc,int packedSize,unsigned char *pDst,int rawSize);
+
+#endif // __MSA__
@@ -0,0 +1,1147 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#include <direct.h>
+#include <fcntl.h>
+#include <psapi.h>
+#pragma comment(lib,"psapi.lib")
+#pragma comment(lib,"ws2_32.lib")
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include <algorithm>
+#include "Platform.h"
+
+// io_uring without liburing: only the kernel header (and glibc statx) is needed
+#if defined(__linux__) && !defined(DIR2MSA_NO_IO_URING) && defined(STATX_SIZE) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define	HOST_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+void	UnixTimeToFileTime(long long t,FILETIME *pTime)
+{
+	unsigned long long ft = (unsigned long long)(t * 10000000LL + 116444736000000000LL);
+	pTime->dwLowDateTime = (DWORD)ft;
+	pTime->dwHighDateTime = (DWORD)(ft >> 32);
+}
+
+int		HostPathType(const char *pPath)
+{
+	struct stat st;
+	if (0 != stat(pPath,&st))
+		return 0;
+	return (st.st_mode & S_IFDIR) ? 2 : 1;
+}
+
+void	HostGlob(const char *pPattern,std::vector<std::string> &paths)
+{
+	if (NULL == strpbrk(pPattern,"*?"))
+	{
+		paths.push_back(pPattern);
+		return;
+	}
+
+#ifdef _WIN32
+	char sDrive[_MAX_DRIVE];
+	char sDir[_MAX_DIR];
+	_splitpath(pPattern,sDrive,sDir,NULL,NULL);
+
+	WIN32_FIND_DATA info;
+	HANDLE hSearch = FindFirstFile(pPattern,&info);
+	if (hSearch != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if ('.' != info.cFileName[0])
+			{
+				char sPath[_MAX_PATH];
+				_makepath(sPath,sDrive,sDir,info.cFileName,NULL);
+				paths.push_back(sPath);
+			}
+		}
+		while (FindNextFile(hSearch,&info));
+		FindClose(hSearch);
+	}
+#else
+	glob_t result;
+	if (0 == glob(pPattern,0,NULL,&result))
+	{
+		for (size_t i=0;i<result.gl_pathc;i++)
+			paths.push_back(result.gl_pathv[i]);
+	}
+	globfree(&result);
+#endif
+}
+
+bool	HostReadFile(const char *pPath,void *pDst,size_t size)
+{
+#ifdef _WIN32
+	HANDLE h = CreateFile(pPath,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if (INVALID_HANDLE_VALUE == h)
+		return false;
+	LARGE_INTEGER fileSize;
+	bool bOk = GetFileSizeEx(h,&fileSize) && ((unsigned long long)fileSize.QuadPart == size);		// changed since the scan
+	unsigned char *p = (unsigned char*)pDst;
+	while (bOk && (size > 0))
+	{
+		DWORD n = (size > (1u<<30)) ? (1u<<30) : (DWORD)size;
+		DWORD nRead = 0;
+		bOk = ReadFile(h,p,n,&nRead,NULL) && (nRead > 0);
+		p += nRead;
+		size -= nRead;
+	}
+	CloseHandle(h);
+	return bOk;
+#else
+	int fd = open(pPath,O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	bool bOk = (0 == fstat(fd,&st)) && ((size_t)st.st_size == size);		// changed since the scan
+	unsigned char *p = (unsigned char*)pDst;
+	while (bOk && (size > 0))
+	{
+		ssize_t n = read(fd,p,size);
+		if ((n < 0) && (EINTR == errno))
+			continue;
+		if (n <= 0)
+			bOk = false;
+		else
+		{
+			p += n;
+			size -= n;
+		}
+	}
+	close(fd);
+	return bOk;
+#endif
+}
+
+#ifdef HOST_IO_URING
+
+// One submission and one completion queue, shared with the kernel. Only used from one thread
+class CIoRing
+{
+public:
+	CIoRing();
+	~CIoRing();
+
+	bool			Init(unsigned nbEntry);
+	io_uring_sqe *	GetSqe();						// cleared, NULL if the queue is full
+	bool			Submit(unsigned nbWait);		// the new entries, and wait for nbWait completions
+	bool			WaitCqe();						// wait for one completion, submit nothing
+	bool			PopCqe(io_uring_cqe *pCqe);
+	unsigned		GetNbUnsubmitted() const		{ return m_sqTail - m_sqSubmitted; }
+
+private:
+	int				m_fd;
+	void		*	m_pSqRing;
+	size_t			m_sqRingSize;
+	void		*	m_pCqRing;
+	size_t			m_cqRingSize;
+	io_uring_sqe *	m_pSqes;
+	size_t			m_sqesSize;
+	unsigned	*	m_pSqHead;
+	unsigned	*	m_pSqTail;
+	unsigned	*	m_pSqArray;
+	unsigned		m_sqMask;
+	unsigned		m_sqEntries;
+	unsigned		m_sqTail;				// prepared
+	unsigned		m_sqSubmitted;
+	unsigned	*	m_pCqHead;
+	unsigned	*	m_pCqTail;
+	io_uring_cqe *	m_pCqes;
+	unsigned		m_cqMask;
+};
+
+CIoRing::CIoRing()
+{
+	m_fd = -1;
+	m_pSqRing = MAP_FAILED;
+	m_pCqRing = MAP_FAILED;
+	m_pSqes = (io_uring_sqe*)MAP_FAILED;
+}
+
+CIoRing::~CIoRing()
+{
+	if (MAP_FAILED != (void*)m_pSqes)
+		munmap(m_pSqes,m_sqesSize);
+	if (MAP_FAILED != m_pCqRing)
+		munmap(m_pCqRing,m_cqRingSize);
+	if (MAP_FAILED != m_pSqRing)
+		munmap(m_pSqRing,m_sqRingSize);
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+bool	CIoRing::Init(unsigned nbEntry)
+{
+	io_uring_params params;
+	memset(&params,0,sizeof(params));
+	m_fd = (int)syscall(__NR_io_uring_setup,nbEntry,&params);
+	if (m_fd < 0)
+		return false;			// old kernel, or disabled (seccomp, sysctl)
+
+	m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	m_pSqRing = mmap(NULL,m_sqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,m_fd,IORING_OFF_SQ_RING);
+	m_pCqRing = mmap(NULL,m_cqRingSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,m_fd,IORING_OFF_CQ_RING);
+	m_pSqes = (io_uring_sqe*)mmap(NULL,m_sqesSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,m_fd,IORING_OFF_SQES);
+	if ((MAP_FAILED == m_pSqRing) || (MAP_FAILED == m_pCqRing) || (MAP_FAILED == (void*)m_pSqes))
+		return false;
+
+	char *pSq = (char*)m_pSqRing;
+	m_pSqHead = (unsigned*)(pSq + params.sq_off.head);
+	m_pSqTail = (unsigned*)(pSq + params.sq_off.tail);
+	m_pSqArray = (unsigned*)(pSq + params.sq_off.array);
+	m_sqMask = *(unsigned*)(pSq + params.sq_off.ring_mask);
+	m_sqEntries = params.sq_entries;
+	m_sqTail = *m_pSqTail;
+	m_sqSubmitted = m_sqTail;
+
+	char *pCq = (char*)m_pCqRing;
+	m_pCqHead = (unsigned*)(pCq + params.cq_off.head);
+	m_pCqTail = (unsigned*)(pCq + params.cq_off.tail);
+	m_pCqes = (io_uring_cqe*)(pCq + params.cq_off.cqes);
+	m_cqMask = *(unsigned*)(pCq + params.cq_off.ring_mask);
+	return true;
+}
+
+io_uring_sqe	*	CIoRing::GetSqe()
+{
+	if (m_sqTail - __atomic_load_n(m_pSqHead,__ATOMIC_ACQUIRE) >= m_sqEntries)
+		return NULL;
+	unsigned index = m_sqTail & m_sqMask;
+	m_pSqArray[index] = index;
+	m_sqTail++;
+	memset(&m_pSqes[index],0,sizeof(io_uring_sqe));
+	return &m_pSqes[index];
+}
+
+bool	CIoRing::Submit(unsigned nbWait)
+{
+	__atomic_store_n(m_pSqTail,m_sqTail,__ATOMIC_RELEASE);
+	int n = (int)syscall(__NR_io_uring_enter,m_fd,m_sqTail - m_sqSubmitted,nbWait,nbWait ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+	if (n < 0)
+		return (EINTR == errno) || (EAGAIN == errno) || (EBUSY == errno);		// try again
+	m_sqSubmitted += n;
+	return true;
+}
+
+bool	CIoRing::WaitCqe()
+{
+	for (;;)
+	{
+		if (syscall(__NR_io_uring_enter,m_fd,0,1,IORING_ENTER_GETEVENTS,NULL,0) >= 0)
+			return true;
+		if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno))
+			return false;
+	}
+}
+
+bool	CIoRing::PopCqe(io_uring_cqe *pCqe)
+{
+	unsigned head = *m_pCqHead;
+	if (head == __atomic_load_n(m_pCqTail,__ATOMIC_ACQUIRE))
+		return false;
+	*pCqe = m_pCqes[head & m_cqMask];
+	__atomic_store_n(m_pCqHead,head + 1,__ATOMIC_RELEASE);
+	return true;
+}
+
+#endif
+
+// Each file is opened and stat'ed, read, then closed, by the kernel: a few
+// io_uring_enter calls for the whole batch instead of 4 blocking calls per file
+bool	HostReadFiles(HostReadRequest *pRequests,int nbRequest)
+{
+#ifdef HOST_IO_URING
+	enum { OP_OPEN, OP_STATX, OP_READ, OP_CLOSE };
+	const unsigned QUEUE_DEPTH = 64;
+
+	CIoRing ring;
+	if (!ring.Init(QUEUE_DEPTH))
+		return false;
+
+	struct FileRead
+	{
+		int				fd;
+		int				nbPending;		// open and statx
+		bool			bError;
+		size_t			done;
+		struct statx	st;
+	};
+	std::vector<FileRead> reads(nbRequest);
+	for (int i=0;i<nbRequest;i++)
+		pRequests[i].bOk = false;
+
+	int next = 0;
+	int nbDone = 0;
+	unsigned nbInFlight = 0;		// never more than the queue: GetSqe can't fail
+	auto Push = [&ring,&nbInFlight](int i,int op) -> io_uring_sqe*
+	{
+		io_uring_sqe *pSqe = ring.GetSqe();
+		pSqe->opcode = (op == OP_OPEN) ? IORING_OP_OPENAT : (op == OP_STATX) ? IORING_OP_STATX : (op == OP_READ) ? IORING_OP_READ : IORING_OP_CLOSE;
+		pSqe->user_data = ((unsigned long long)i << 2) | op;
+		nbInFlight++;
+		return pSqe;
+	};
+	auto Read = [&](int i)
+	{
+		io_uring_sqe *pSqe = Push(i,OP_READ);
+		pSqe->fd = reads[i].fd;
+		pSqe->addr = (unsigned long long)(uintptr_t)((char*)pRequests[i].pDst + reads[i].done);
+		pSqe->len = (unsigned)std::min(pRequests[i].size - reads[i].done,(size_t)1 << 30);
+		pSqe->off = reads[i].done;
+	};
+	auto Close = [&](int i)
+	{
+		if (reads[i].fd >= 0)
+			Push(i,OP_CLOSE)->fd = reads[i].fd;
+		else
+			nbDone++;
+	};
+
+	io_uring_cqe cqe;
+	while (nbDone < nbRequest)
+	{
+		while ((next < nbRequest) && (nbInFlight + 2 <= QUEUE_DEPTH))
+		{
+			HostReadRequest &request = pRequests[next];
+			FileRead &file = reads[next];
+			file.fd = -1;
+			file.nbPending = 2;
+			file.bError = false;
+			file.done = 0;
+
+			io_uring_sqe *pSqe = Push(next,OP_OPEN);
+			pSqe->fd = AT_FDCWD;
+			pSqe->addr = (unsigned long long)(uintptr_t)request.pPath;
+			pSqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+			pSqe = Push(next,OP_STATX);
+			pSqe->fd = AT_FDCWD;
+			pSqe->addr = (unsigned long long)(uintptr_t)request.pPath;
+			pSqe->len = STATX_SIZE;
+			pSqe->off = (unsigned long long)(uintptr_t)&file.st;
+			next++;
+		}
+
+		if (!ring.Submit(1))
+		{	// the kernel still owns the submitted ops (they point at reads[] and the
+			// destination buffers): wait for them before giving up on the rest
+			unsigned nbKernel = nbInFlight - ring.GetNbUnsubmitted();
+			while (nbKernel > 0)
+			{
+				if (!ring.PopCqe(&cqe))
+				{
+					if (!ring.WaitCqe())
+						abort();			// can't know when the kernel is done with our buffers
+					continue;
+				}
+				nbKernel--;
+				int i = (int)(cqe.user_data >> 2);
+				if ((OP_OPEN == (cqe.user_data & 3)) && (cqe.res >= 0))
+					reads[i].fd = cqe.res;
+				else if (OP_CLOSE == (cqe.user_data & 3))
+				{
+					reads[i].fd = -1;
+					pRequests[i].bOk = !reads[i].bError;
+				}
+			}
+			for (int i=0;i<next;i++)
+			{
+				if (reads[i].fd >= 0)
+				{	// not closed by the kernel: not complete either
+					close(reads[i].fd);
+					reads[i].fd = -1;
+					pRequests[i].bOk = false;
+				}
+			}
+			break;			// the files not done are left failed, for HostReadFile
+		}
+
+		while (ring.PopCqe(&cqe))
+		{
+			nbInFlight--;
+			int i = (int)(cqe.user_data >> 2);
+			HostReadRequest &request = pRequests[i];
+			FileRead &file = reads[i];
+			switch (cqe.user_data & 3)
+			{
+				case OP_OPEN:
+				case OP_STATX:
+					if (OP_OPEN == (cqe.user_data & 3))
+					{
+						if (cqe.res >= 0)
+							file.fd = cqe.res;
+						else
+							file.bError = true;
+					}
+					else if ((cqe.res < 0) || (file.st.stx_size != request.size))		// changed since the scan
+						file.bError = true;
+
+					if (0 == --file.nbPending)
+					{
+						if (file.bError || (0 == request.size))
+							Close(i);
+						else
+							Read(i);
+					}
+					break;
+
+				case OP_READ:
+					if ((-EINTR == cqe.res) || (-EAGAIN == cqe.res))
+						Read(i);
+					else if (cqe.res <= 0)
+					{
+						file.bError = true;
+						Close(i);
+					}
+					else
+					{
+						file.done += cqe.res;
+						if (file.done < request.size)
+							Read(i);
+						else
+							Close(i);
+					}
+					break;
+
+				case OP_CLOSE:
+					file.fd = -1;
+					request.bOk = !file.bError;
+					nbDone++;
+					break;
+			}
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool	HostMakeDir(const char *pPath)
+{
+#ifdef _WIN32
+	if (0 == _mkdir(pPath))
+		return true;
+#else
+	if (0 == mkdir(pPath,0777))
+		return true;
+#endif
+	return (2 == HostPathType(pPath));
+}
+
+bool	HostMakeDirs(const char *pPath)
+{
+	char sPath[_MAX_PATH];
+	if ((size_t)snprintf(sPath,sizeof(sPath),"%s",pPath) >= sizeof(sPath))
+		return false;
+
+	for (char *p = sPath + 1;*p;p++)		// + 1: never the root itself
+	{
+		if (('/' != *p) && ('\\' != *p))
+			continue;
+		if (('/' == p[-1]) || ('\\' == p[-1]) || (':' == p[-1]))
+			continue;						// "//", or a drive "C:\"
+		char c = *p;
+		*p = 0;
+		bool bOk = HostMakeDir(sPath);
+		*p = c;
+		if (!bOk)
+			return false;
+	}
+	return HostMakeDir(sPath);
+}
+
+bool	HostRemoveTree(const char *pPath)
+{
+	bool bOk = true;
+#ifdef _WIN32
+	WIN32_FIND_DATA info;
+	std::string pattern = std::string(pPath) + "\\*";
+	HANDLE hSearch = FindFirstFile(pattern.c_str(),&info);
+	if (hSearch != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if ((0 == strcmp(info.cFileName,".")) || (0 == strcmp(info.cFileName,"..")))
+				continue;
+			std::string path = std::string(pPath) + "\\" + info.cFileName;
+			if (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				bOk &= HostRemoveTree(path.c_str());
+			else
+				bOk &= (0 != DeleteFile(path.c_str()));
+		}
+		while (FindNextFile(hSearch,&info));
+		FindClose(hSearch);
+	}
+	return bOk && (0 != RemoveDirectory(pPath));
+#else
+	DIR *pDir = opendir(pPath);
+	if (NULL == pDir)
+		return false;
+	while (struct dirent *pEntry = readdir(pDir))
+	{
+		if ((0 == strcmp(pEntry->d_name,".")) || (0 == strcmp(pEntry->d_name,"..")))
+			continue;
+		std::string path = std::string(pPath) + "/" + pEntry->d_name;
+		struct stat st;
+		if ((0 == lstat(path.c_str(),&st)) && S_ISDIR(st.st_mode))
+			bOk &= HostRemoveTree(path.c_str());
+		else
+			bOk &= (0 == unlink(path.c_str()));
+	}
+	closedir(pDir);
+	return bOk && (0 == rmdir(pPath));
+#endif
+}
+
+bool	HostReplaceFile(const char *pSrc,const char *pDst)
+{
+#ifdef _WIN32
+	return (0 != MoveFileEx(pSrc,pDst,MOVEFILE_REPLACE_EXISTING));
+#else
+	return (0 == rename(pSrc,pDst));
+#endif
+}
+
+bool	HostSetFileTime(const char *pPath,const FILETIME *pTime)
+{
+#ifdef _WIN32
+	HANDLE h = CreateFile(pPath,FILE_WRITE_ATTRIBUTES,0,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if (INVALID_HANDLE_VALUE == h)
+		return false;
+	bool bOk = (0 != SetFileTime(h,NULL,NULL,pTime));
+	CloseHandle(h);
+	return bOk;
+#else
+	unsigned long long ft = ((unsigned long long)pTime->dwHighDateTime << 32) | pTime->dwLowDateTime;
+	struct utimbuf times;
+	times.actime = times.modtime = (time_t)(((long long)ft - 116444736000000000LL) / 10000000LL);
+	return (0 == utime(pPath,&times));
+#endif
+}
+
+void	HostTempDir(char *sDir)
+{
+#ifdef _WIN32
+	DWORD len = GetTempPath(_MAX_PATH,sDir);
+	if ((0 == len) || (len >= _MAX_PATH))
+		strcpy(sDir,".");
+	else if ('\\' == sDir[len-1])
+		sDir[len-1] = 0;
+#else
+	const char *pTmp = getenv("TMPDIR");
+	snprintf(sDir,_MAX_PATH,"%s",(pTmp && *pTmp) ? pTmp : "/tmp");
+	size_t len = strlen(sDir);
+	if ((len > 1) && ('/' == sDir[len-1]))
+		sDir[len-1] = 0;
+#endif
+}
+
+double	HostCpuTime()
+{
+#ifdef _WIN32
+	FILETIME creation,exit,kernel,user;
+	if (!GetProcessTimes(GetCurrentProcess(),&creation,&exit,&kernel,&user))
+		return 0.0;
+	unsigned long long ticks = ((unsigned long long)kernel.dwHighDateTime << 32) + kernel.dwLowDateTime +
+							   ((unsigned long long)user.dwHighDateTime << 32) + user.dwLowDateTime;
+	return (double)ticks / 10000.0;
+#else
+	struct rusage usage;
+	if (0 != getrusage(RUSAGE_SELF,&usage))
+		return 0.0;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#endif
+}
+
+long long	HostPeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(),&counters,sizeof(counters)))
+		return 0;
+	return (long long)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (0 != getrusage(RUSAGE_SELF,&usage))
+		return 0;
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;			// bytes
+#else
+	return (long long)usage.ru_maxrss * 1024;	// KB
+#endif
+#endif
+}
+
+bool	HostFullPath(const char *pPath,char *sFullPath)
+{
+#ifdef _WIN32
+	return (NULL != _fullpath(sFullPath,pPath,_MAX_PATH));
+#else
+	if ('/' == pPath[0])
+		return (size_t)snprintf(sFullPath,_MAX_PATH,"%s",pPath) < _MAX_PATH;
+	char sDir[_MAX_PATH];
+	if (NULL == getcwd(sDir,sizeof(sDir)))
+		return false;
+	while (('.' == pPath[0]) && ('/' == pPath[1]))
+		pPath += 2;
+	return (size_t)snprintf(sFullPath,_MAX_PATH,"%s/%s",sDir,pPath) < _MAX_PATH;
+#endif
+}
+
+bool	HostFileInfo(const char *pPath,long long *pSize,FILETIME *pTime)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesEx(pPath,GetFileExInfoStandard,&info))
+		return false;
+	*pSize = ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	*pTime = info.ftLastWriteTime;
+	return true;
+#else
+	struct stat st;
+	if (0 != stat(pPath,&st))
+		return false;
+	*pSize = (long long)st.st_size;
+#ifdef __APPLE__
+	const struct timespec &t = st.st_mtimespec;
+#else
+	const struct timespec &t = st.st_mtim;
+#endif
+	unsigned long long ft = (unsigned long long)((long long)t.tv_sec * 10000000LL + t.tv_nsec / 100 + 116444736000000000LL);
+	pTime->dwLowDateTime = (DWORD)ft;
+	pTime->dwHighDateTime = (DWORD)(ft >> 32);
+	return true;
+#endif
+}
+
+bool	HostSetBinaryMode(FILE *h)
+{
+#ifdef _WIN32
+	return (-1 != _setmode(_fileno(h),_O_BINARY));
+#else
+	(void)h;
+	return true;
+#endif
+}
+
+
+CMappedFile::CMappedFile()
+{
+	m_pData = NULL;
+	m_size = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+// Empty files can't be mapped: Open fails on them
+bool	CMappedFile::Open(const char *pName)
+{
+	Close();
+#ifdef _WIN32
+	m_hFile = CreateFile(pName,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+		return false;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(m_hFile,&size) && (size.QuadPart > 0))
+	{
+		m_hMapping = CreateFileMapping(m_hFile,NULL,PAGE_READONLY,0,0,NULL);
+		if (m_hMapping)
+		{
+			m_pData = (const unsigned char*)MapViewOfFile(m_hMapping,FILE_MAP_READ,0,0,0);
+			m_size = (size_t)size.QuadPart;
+		}
+	}
+#else
+	int fd = open(pName,O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if ((0 == fstat(fd,&st)) && (st.st_size > 0))
+	{
+		void *p = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if (MAP_FAILED != p)
+		{
+			m_pData = (const unsigned char*)p;
+			m_size = (size_t)st.st_size;
+		}
+	}
+	close(fd);		// the mapping keeps the file
+#endif
+	if (NULL == m_pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void	CMappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (INVALID_HANDLE_VALUE != m_hFile)
+		CloseHandle(m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData)
+		munmap((void*)m_pData,m_size);
+#endif
+	m_pData = NULL;
+	m_size = 0;
+}
+
+
+CMappedOutput::CMappedOutput()
+{
+	m_pData = NULL;
+	m_size = 0;
+#ifdef _WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#else
+	m_fd = -1;
+#endif
+}
+
+CMappedOutput::~CMappedOutput()
+{
+	Close();
+}
+
+bool	CMappedOutput::Create(const char *pName,size_t size)
+{
+	Close();
+	if (0 == size)
+		return false;
+#ifdef _WIN32
+	m_hFile = CreateFile(pName,GENERIC_READ|GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+		return false;
+	// the mapping object sets the file size and commits the disk space
+	m_hMapping = CreateFileMapping(m_hFile,NULL,PAGE_READWRITE,(DWORD)((unsigned long long)size >> 32),(DWORD)size,NULL);
+	if (m_hMapping)
+		m_pData = (unsigned char*)MapViewOfFile(m_hMapping,FILE_MAP_WRITE,0,0,size);
+#else
+	m_fd = open(pName,O_RDWR|O_CREAT|O_TRUNC,0666);
+	if (m_fd < 0)
+		return false;
+	// blocks are allocated now: a full disk would otherwise be a SIGBUS on first write
+#ifdef __APPLE__
+	bool bReserved = false;			// no posix_fallocate
+#else
+	bool bReserved = (0 == posix_fallocate(m_fd,0,(off_t)size));
+#endif
+	if (bReserved)
+	{
+		void *p = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,m_fd,0);
+		if (MAP_FAILED != p)
+			m_pData = (unsigned char*)p;
+	}
+#endif
+	if (NULL == m_pData)
+	{
+		Close();
+		return false;
+	}
+	m_size = size;
+	return true;
+}
+
+// false if the data may not have reached the file
+bool	CMappedOutput::Close()
+{
+	bool bOk = true;
+#ifdef _WIN32
+	if (m_pData)
+		bOk = (FALSE != UnmapViewOfFile(m_pData));
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (INVALID_HANDLE_VALUE != m_hFile)
+		bOk = (FALSE != CloseHandle(m_hFile)) && bOk;
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData)
+		bOk = (0 == munmap(m_pData,m_size));
+	if (m_fd >= 0)
+		bOk = (0 == close(m_fd)) && bOk;
+	m_fd = -1;
+#endif
+	m_pData = NULL;
+	m_size = 0;
+	return bOk;
+}
+
+#ifdef _WIN32
+typedef	SOCKET	SocketHandle;
+static	void	CloseSocket(SocketHandle h)	{ closesocket(h); }
+static	bool	SocketStartup()
+{
+	static bool s_bStarted = []
+	{
+		WSADATA data;
+		return (0 == WSAStartup(MAKEWORD(2,2),&data));
+	}();
+	return s_bStarted;
+}
+#else
+typedef	int		SocketHandle;
+static	void	CloseSocket(SocketHandle h)	{ close(h); }
+static	bool	SocketStartup()		{ return true; }
+#endif
+
+static	const	size_t	SOCKET_BUFFER_SIZE	=	64*1024;
+
+static	bool	SocketAddress(const char *pPath,struct sockaddr_un *pAddress)
+{
+	memset(pAddress,0,sizeof(*pAddress));
+	pAddress->sun_family = AF_UNIX;
+	if (strlen(pPath) >= sizeof(pAddress->sun_path))
+		return false;
+	strcpy(pAddress->sun_path,pPath);
+	return true;
+}
+
+CLocalSocket::CLocalSocket()
+{
+	m_handle = -1;
+	m_readPos = 0;
+	m_readEnd = 0;
+}
+
+CLocalSocket::~CLocalSocket()
+{
+	Close();
+}
+
+void	CLocalSocket::Close()
+{
+	if (-1 != m_handle)
+		CloseSocket((SocketHandle)m_handle);
+	m_handle = -1;
+	m_readPos = 0;
+	m_readEnd = 0;
+}
+
+bool	CLocalSocket::Connect(const char *pPath)
+{
+	Close();
+	struct sockaddr_un address;
+	if (!SocketStartup() || !SocketAddress(pPath,&address))
+		return false;
+	SocketHandle h = socket(AF_UNIX,SOCK_STREAM,0);
+	if ((SocketHandle)-1 == h)
+		return false;
+	m_handle = (intptr_t)h;
+	if (0 != connect(h,(struct sockaddr*)&address,sizeof(address)))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool	CLocalSocket::Listen(const char *pPath)
+{
+	Close();
+	struct sockaddr_un address;
+	if (!SocketStartup() || !SocketAddress(pPath,&address))
+		return false;
+
+	{	// socket file left by a server that did not stop cleanly
+		CLocalSocket probe;
+		if (probe.Connect(pPath))
+			return false;
+#ifdef _WIN32
+		DeleteFile(pPath);
+#else
+		unlink(pPath);
+#endif
+	}
+
+	SocketHandle h = socket(AF_UNIX,SOCK_STREAM,0);
+	if ((SocketHandle)-1 == h)
+		return false;
+	m_handle = (intptr_t)h;
+	if ((0 != bind(h,(struct sockaddr*)&address,sizeof(address))) || (0 != listen(h,64)))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool	CLocalSocket::Accept(CLocalSocket &client)
+{
+	client.Close();
+	for (;;)
+	{
+		SocketHandle h = accept((SocketHandle)m_handle,NULL,NULL);
+		if ((SocketHandle)-1 != h)
+		{
+			client.m_handle = (intptr_t)h;
+			return true;
+		}
+#ifndef _WIN32
+		if (EINTR == errno)
+			continue;
+#endif
+		return false;
+	}
+}
+
+bool	CLocalSocket::SetReceiveTimeout(int ms)
+{
+#ifdef _WIN32
+	DWORD timeout = (DWORD)ms;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+	return (0 == setsockopt((SocketHandle)m_handle,SOL_SOCKET,SO_RCVTIMEO,(const char*)&timeout,sizeof(timeout)));
+}
+
+bool	CLocalSocket::Send(const void *pData,size_t size)
+{
+	const char *p = (const char*)pData;
+	while (size > 0)
+	{
+		int n = (size > (1u<<30)) ? (1<<30) : (int)size;
+#ifdef _WIN32
+		n = send((SocketHandle)m_handle,p,n,0);
+#else
+#ifdef MSG_NOSIGNAL
+		n = (int)send((SocketHandle)m_handle,p,n,MSG_NOSIGNAL);		// a gone peer is an error, not a SIGPIPE
+#else
+		n = (int)send((SocketHandle)m_handle,p,n,0);
+#endif
+		if ((n < 0) && (EINTR == errno))
+			continue;
+#endif
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool	CLocalSocket::Fill()
+{
+	if (m_buffer.empty())
+		m_buffer.resize(SOCKET_BUFFER_SIZE);
+	for (;;)
+	{
+		int n = (int)recv((SocketHandle)m_handle,m_buffer.data(),(int)m_buffer.size(),0);
+#ifndef _WIN32
+		if ((n < 0) && (EINTR == errno))
+			continue;
+#endif
+		if (n <= 0)
+			return false;
+		m_readPos = 0;
+		m_readEnd = n;
+		return true;
+	}
+}
+
+bool	CLocalSocket::Receive(void *pData,size_t size)
+{
+	char *p = (char*)pData;
+	while (size > 0)
+	{
+		if ((m_readPos == m_readEnd) && !Fill())
+			return false;
+		size_t n = std::min(size,m_readEnd - m_readPos);
+		memcpy(p,m_buffer.data() + m_readPos,n);
+		m_readPos += n;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool	CLocalSocket::ReceiveLine(std::string &line)
+{
+	line.clear();
+	for (;;)
+	{
+		if ((m_readPos == m_readEnd) && !Fill())
+			return false;
+		const char *pStart = m_buffer.data() + m_readPos;
+		const char *pEnd = (const char*)memchr(pStart,'\n',m_readEnd - m_readPos);
+		if (pEnd)
+		{
+			line.append(pStart,pEnd - pStart);
+			m_readPos += (pEnd - pStart) + 1;
+			return true;
+		}
+		line.append(pStart,m_readEnd - m_readPos);
+		m_readPos = m_readEnd;
+		if (line.size() > SOCKET_BUFFER_SIZE)
+			return false;
+	}
+}
+
+
+#ifndef _WIN32
+
+char*	strupr(char *pStr)
+{
+	for (char *p = pStr;*p;p++)
+		*p = (char)toupper((unsigned char)*p);
+	return pStr;
+}
+
+// Same contract as the MSVC runtime one, '/' being the separator
+void	_splitpath(const char *pPath,char *pDrive,char *pDir,char *pFname,char *pExt)
+{
+	const char *pSlash = strrchr(pPath,'/');
+	const char *pName = pSlash ? pSlash + 1 : pPath;
+	const char *pDot = strrchr(pName,'.');
+	if (NULL == pDot)
+		pDot = pName + strlen(pName);
+
+	if (pDrive)
+		*pDrive = 0;
+
+	if (pDir)
+	{
+		size_t len = pName - pPath;
+		memcpy(pDir,pPath,len);
+		pDir[len] = 0;
+	}
+
+	if (pFname)
+	{
+		size_t len = pDot - pName;
+		if (len >= _MAX_FNAME)
+			len = _MAX_FNAME - 1;
+		memcpy(pFname,pName,len);
+		pFname[len] = 0;
+	}
+
+	if (pExt)
+	{
+		strncpy(pExt,pDot,_MAX_EXT-1);
+		pExt[_MAX_EXT-1] = 0;
+	}
+}
+
+void	_makepath(char *pPath,const char *pDrive,const char *pDir,const char *pFname,const char *pExt)
+{
+	*pPath = 0;
+	if (pDrive)
+		strcat(pPath,pDrive);
+	if (pDir && *pDir)
+	{
+		strcat(pPath,pDir);
+		if ('/' != pPath[strlen(pPath)-1])
+			strcat(pPath,"/");
+	}
+	if (pFname)
+		strcat(pPath,pFname);
+	if (pExt && *pExt)
+	{
+		if ('.' != *pExt)
+			strcat(pPath,".");
+		strcat(pPath,pExt);
+	}
+}
+
+bool	FileTimeToDosDateTime(const FILETIME *pTime,WORD *pDate,WORD *pTime16)
+{
+	unsigned long long ft = ((unsigned long long)pTime->dwHighDateTime << 32) | pTime->dwLowDateTime;
+	if (ft < 116444736000000000ULL)
+	{	// before 1970: use the DOS epoch
+		*pDate = (0<<9) | (1<<5) | 1;
+		*pTime16 = 0;
+		return true;
+	}
+
+	time_t t = (time_t)((ft - 116444736000000000ULL) / 10000000ULL);
+	struct tm tmp;
+	gmtime_r(&t,&tmp);
+
+	int year = tmp.tm_year + 1900;
+	if (year < 1980)
+	{
+		*pDate = (0<<9) | (1<<5) | 1;
+		*pTime16 = 0;
+		return true;
+	}
+
+	*pDate = (WORD)(((year - 1980) << 9) | ((tmp.tm_mon + 1) << 5) | tmp.tm_mday);
+	*pTime16 = (WORD)((tmp.tm_hour << 11) | (tmp.tm_min << 5) | (tmp.tm_sec / 2));
+	return true;
+}
+
+int		CompareFileTime(const FILETIME *pTime1,const FILETIME *pTime2)
+{
+	unsigned long long t1 = ((unsigned long long)pTime1->dwHighDateTime << 32) | pTime1->dwLowDateTime;
+	unsigned long long t2 = ((unsigned long long)pTime2->dwHighDateTime << 32) | pTime2->dwLowDateTime;
+	return (t1 < t2) ? -1 : ((t1 > t2) ? 1 : 0);
+}
+
+// No time zone involved, like the Win32 one (so it round trips with FileTimeToDosDateTime)
+bool	DosDateTimeToFileTime(WORD date,WORD time16,FILETIME *pTime)
+{
+	int year = 1980 + (date >> 9);
+	int month = (date >> 5) & 15;
+	int day = date & 31;
+	if ((month < 1) || (month > 12) || (day < 1))
+		return false;
+
+	// days since 1970-01-01 of a proleptic gregorian date
+	int y = (month <= 2) ? year - 1 : year;
+	int era = y / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	long long days = (long long)era * 146097 + doe - 719468;
+
+	long long t = days * 86400 + (time16 >> 11) * 3600 + ((time16 >> 5) & 63) * 60 + (time16 & 31) * 2;
+	UnixTimeToFileTime(t,pTime);
+	return true;
+}
+
+#endif
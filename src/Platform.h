@@ -0,0 +1,204 @@
+
+#ifndef __PLATFORM__
+#define __PLATFORM__
+
+//--------------------------------------------------------------------------
+// Host platform layer.
+// On Windows this is only <windows.h>. On POSIX hosts it provides the small
+// subset of the Win32 / MSVC runtime names used by dir2msa, so the floppy
+// building code stays the same on both sides.
+//--------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <io.h>
+
+#else
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define	_MAX_PATH		4096
+#define	_MAX_DRIVE		3
+#define	_MAX_DIR		4096
+#define	_MAX_FNAME		256
+#define	_MAX_EXT		256
+
+#define	FILE_ATTRIBUTE_HIDDEN		0x02
+#define	FILE_ATTRIBUTE_SYSTEM		0x04
+#define	FILE_ATTRIBUTE_DIRECTORY	0x10
+
+typedef	unsigned short	WORD;
+typedef	unsigned int	DWORD;
+
+struct FILETIME
+{
+	DWORD	dwLowDateTime;
+	DWORD	dwHighDateTime;
+};
+
+// Only the fields dir2msa actually reads
+struct WIN32_FIND_DATA
+{
+	DWORD		dwFileAttributes;
+	FILETIME	ftLastWriteTime;
+	DWORD		nFileSizeLow;
+	char		cFileName[_MAX_FNAME];
+	char		cAlternateFileName[14];
+};
+
+#define	stricmp		strcasecmp
+
+char*	strupr(char *pStr);
+void	_splitpath(const char *pPath,char *pDrive,char *pDir,char *pFname,char *pExt);
+void	_makepath(char *pPath,const char *pDrive,const char *pDir,const char *pFname,const char *pExt);
+bool	FileTimeToDosDateTime(const FILETIME *pTime,WORD *pDate,WORD *pTime16);
+bool	DosDateTimeToFileTime(WORD date,WORD time16,FILETIME *pTime);
+int		CompareFileTime(const FILETIME *pTime1,const FILETIME *pTime2);
+
+#endif
+
+//--------------------------------------------------------------------------
+// Portable helpers (both platforms)
+//--------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Unix time (seconds since 1970) to FILETIME (100ns ticks since 1601)
+void	UnixTimeToFileTime(long long t,FILETIME *pTime);
+
+// returns 0 if the path does not exist, 1 for a file, 2 for a directory
+int		HostPathType(const char *pPath);
+
+// Append the paths matching a '*'/'?' pattern (or the path itself when there is no wildcard)
+void	HostGlob(const char *pPattern,std::vector<std::string> &paths);
+
+// Read a whole file of exactly size bytes to pDst (no intermediate buffer)
+bool	HostReadFile(const char *pPath,void *pDst,size_t size);
+
+// One whole file for HostReadFiles
+struct HostReadRequest
+{
+	const char	*	pPath;
+	void		*	pDst;
+	size_t			size;			// exact size (as scanned)
+	bool			bOk;			// out
+};
+
+// Read many whole files at once, with dozens of requests in flight (io_uring on Linux,
+// unless built with DIR2MSA_NO_IO_URING). false if the host can't: nothing was read.
+// Otherwise the failed ones may be tried again with HostReadFile
+bool	HostReadFiles(HostReadRequest *pRequests,int nbRequest);
+
+// Create one directory level (true if it already exists as a directory)
+bool	HostMakeDir(const char *pPath);
+
+// Same, with every missing parent
+bool	HostMakeDirs(const char *pPath);
+
+// Delete a directory and everything in it
+bool	HostRemoveTree(const char *pPath);
+
+// Rename pSrc to pDst, replacing pDst if it exists
+bool	HostReplaceFile(const char *pSrc,const char *pDst);
+
+// Set the last write time of a file
+bool	HostSetFileTime(const char *pPath,const FILETIME *pTime);
+
+// Directory for temporary files (no trailing separator)
+void	HostTempDir(char *sDir);
+
+// CPU time of the whole process (every thread, user + kernel), in ms
+double	HostCpuTime();
+
+// Peak resident memory of the process so far, in bytes (0 if unknown)
+long long	HostPeakMemory();
+
+// Absolute path from the current directory (the path does not need to exist)
+bool	HostFullPath(const char *pPath,char *sFullPath);
+
+// Size and last write time of a file. false if it does not exist
+bool	HostFileInfo(const char *pPath,long long *pSize,FILETIME *pTime);
+
+// Switch stdin/stdout to binary (no CRLF translation on Windows)
+bool	HostSetBinaryMode(FILE *h);
+
+// Read only view of a whole file
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	bool	Open(const char *pName);
+	void	Close();
+
+	const unsigned char	*	GetData() const		{ return m_pData; }
+	size_t					GetSize() const		{ return m_size; }
+
+private:
+	const unsigned char	*	m_pData;
+	size_t					m_size;
+#ifdef _WIN32
+	HANDLE					m_hFile;
+	HANDLE					m_hMapping;
+#endif
+};
+
+// Writable view of a new file of a given size (replaces an existing one). Create fails
+// when the space can't be reserved first: then the caller writes the file another way
+class CMappedOutput
+{
+public:
+	CMappedOutput();
+	~CMappedOutput();
+
+	bool	Create(const char *pName,size_t size);
+	bool	Close();
+
+	unsigned char	*	GetData() const		{ return m_pData; }
+	size_t				GetSize() const		{ return m_size; }
+
+private:
+	unsigned char	*	m_pData;
+	size_t				m_size;
+#ifdef _WIN32
+	HANDLE				m_hFile;
+	HANDLE				m_hMapping;
+#else
+	int					m_fd;
+#endif
+};
+
+// Local stream socket: Unix domain socket (AF_UNIX, also on Windows 10 and later).
+// Reads are buffered, so a text header and the binary data after it can be mixed
+class CLocalSocket
+{
+public:
+	CLocalSocket();
+	~CLocalSocket();
+
+	bool	Listen(const char *pPath);			// fails if a server already answers there
+	bool	Accept(CLocalSocket &client);
+	bool	Connect(const char *pPath);
+	bool	SetReceiveTimeout(int ms);				// then a receive fails after ms without a byte
+	void	Close();
+
+	bool	Send(const void *pData,size_t size);	// everything, or fails
+	bool	Receive(void *pData,size_t size);		// exactly size bytes
+	bool	ReceiveLine(std::string &line);			// up to '\n' (not included)
+
+private:
+	bool	Fill();
+
+	intptr_t				m_handle;			// SOCKET on Windows, -1: none
+	std::vector<char>		m_buffer;
+	size_t					m_readPos;
+	size_t					m_readEnd;
+};
+
+#endif // __PLATFORM__
@@ -0,0 +1,640 @@
+
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Dir2Floppy.h"
+#include "Server.h"
+#include "ThreadPool.h"
+
+#include "ZIP/ZIPIO.H"
+
+static	const	char	*	PROTOCOL				=	"DIR2MSA 1";
+static	const	int			TREE_CACHE_SIZE			=	32;
+static	const	unsigned long	MAX_INLINE_SIZE		=	64*1024*1024;
+static	const	int			RECEIVE_TIMEOUT_MS		=	5000;		// an idle or stalled client is dropped
+
+enum
+{
+	SERVE_OK = 0,
+	SERVE_BAD_REQUEST,
+	SERVE_BAD_PATH,
+	SERVE_BAD_INPUT,
+	SERVE_NO_SPACE,
+	SERVE_READ_ERROR,
+	SERVE_WRITE_ERROR,
+};
+
+static	const char*	ServeErrorString(int status)
+{
+	switch (status)
+	{
+		case SERVE_OK:				return "ok";
+		case SERVE_BAD_REQUEST:		return "bad request";
+		case SERVE_BAD_PATH:		return "not a valid path";
+		case SERVE_BAD_INPUT:		return "not a directory, or not a ZIP file";
+		case SERVE_NO_SPACE:		return "does not fit on the disk";
+		case SERVE_READ_ERROR:		return "could not read a file";
+		case SERVE_WRITE_ERROR:		return "could not write the image";
+	}
+	return "unknown error";
+}
+
+// Same names as the command line: "DEMO" -> "DEMO.msa", "DEMO.ZIP" -> "DEMO.msa".
+// sImageName is _MAX_PATH long: false if the name does not fit
+static	bool	DefaultImageName(const char *pInput,bool bDirectory,ImageFormat format,char *sImageName)
+{
+	const char *pExt = ImageFormatExtension(format);
+	if (bDirectory)
+		return (size_t)snprintf(sImageName,_MAX_PATH,"%s%s",pInput,pExt) < _MAX_PATH;
+
+	if (strlen(pInput) >= _MAX_DIR)
+		return false;
+	char sDrive[_MAX_DRIVE];
+	char sDir[_MAX_DIR];
+	char sFname[_MAX_FNAME];
+	_splitpath(pInput,sDrive,sDir,sFname,NULL);
+	if (strlen(sDrive) + strlen(sDir) + strlen(sFname) + strlen(pExt) + 2 > _MAX_PATH)		// + separator
+		return false;
+	_makepath(sImageName,sDrive,sDir,sFname,pExt);
+	return true;
+}
+
+static	bool	WriteWholeFile(const char *pName,const unsigned char *pData,size_t size)
+{
+	FILE *h = fopen(pName,"wb");
+	if (NULL == h)
+		return false;
+	bool bOk = (size == fwrite(pData,1,size,h));
+	return (0 == fclose(h)) && bOk;
+}
+
+
+//--------------- Tree cache ---------------------------------------------
+
+// A ZIP file scanned by a previous request. Its source keeps one open ZIPIO handle per
+// worker, so the next build of the same archive neither parses nor opens it again
+struct CachedTree
+{
+	std::string			path;
+	long long			size;
+	FILETIME			time;
+	CArena				arena;
+	CDirectory		*	pRoot;
+	CZIPFileSource	*	pSource;
+	unsigned long long	lastUse;
+
+	CachedTree() : pRoot(NULL), pSource(NULL), lastUse(0)	{}
+	~CachedTree()		{ delete pSource; }
+};
+
+// An entry is taken out of the cache while a build uses it: Fill writes the cluster
+// numbers of that image to the tree
+class CTreeCache
+{
+public:
+	CTreeCache()		{ m_clock = 0; }
+	~CTreeCache();
+
+	CachedTree	*	Take(const char *pPath,long long size,const FILETIME &time);	// NULL: not cached, or changed since
+	void			Give(CachedTree *pTree);
+
+private:
+	std::mutex					m_mutex;
+	std::vector<CachedTree*>	m_trees;
+	unsigned long long			m_clock;
+};
+
+CTreeCache::~CTreeCache()
+{
+	for (size_t i=0;i<m_trees.size();i++)
+		delete m_trees[i];
+}
+
+CachedTree	*	CTreeCache::Take(const char *pPath,long long size,const FILETIME &time)
+{
+	CachedTree *pTree = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i=0;i<m_trees.size();i++)
+		{
+			if (m_trees[i]->path == pPath)
+			{
+				pTree = m_trees[i];
+				m_trees.erase(m_trees.begin() + i);
+				break;
+			}
+		}
+	}
+
+	if (pTree && ((pTree->size != size) || (0 != CompareFileTime(&pTree->time,&time))))
+	{
+		delete pTree;
+		pTree = NULL;
+	}
+	return pTree;
+}
+
+// The least recently used entry goes when the cache is full
+void	CTreeCache::Give(CachedTree *pTree)
+{
+	CachedTree *pEvicted = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pTree->lastUse = ++m_clock;
+		m_trees.push_back(pTree);
+		if ((int)m_trees.size() > TREE_CACHE_SIZE)
+		{
+			size_t oldest = 0;
+			for (size_t i=1;i<m_trees.size();i++)
+			{
+				if (m_trees[i]->lastUse < m_trees[oldest]->lastUse)
+					oldest = i;
+			}
+			pEvicted = m_trees[oldest];
+			m_trees.erase(m_trees.begin() + oldest);
+		}
+	}
+	delete pEvicted;
+}
+
+// NULL if it's not a ZIP archive
+static	CachedTree	*	ScanZIP(const char *pPath,long long size,const FILETIME &time)
+{
+	CachedTree *pTree = new CachedTree;
+	pTree->pSource = new CZIPFileSource(pPath);
+	ZFILE *pZIP = pTree->pSource->Open();
+	if (NULL == pZIP)
+	{
+		delete pTree;
+		return NULL;
+	}
+
+	if (zIsZIP(pZIP))
+		pTree->pRoot = CreateTreeFromZIP(pZIP,&pTree->arena);
+	zclose(pZIP);
+
+	if (NULL == pTree->pRoot)
+	{
+		delete pTree;
+		return NULL;
+	}
+	pTree->path = pPath;
+	pTree->size = size;
+	pTree->time = time;
+	return pTree;
+}
+
+
+//--------------- Server -------------------------------------------------
+
+struct ServeRequest
+{
+	bool						bStop;
+	std::string					input;			// host path
+	std::vector<unsigned char>	zip;			// or the archive itself
+	std::string					output;			// empty: next to the input
+	bool						bReturn;		// image bytes in the reply
+	ImageFormat					format;
+	bool						bSmallest;
+	long long					maxFileTime;
+};
+
+// false if the request is not readable (nothing is replied then)
+static	bool	ReceiveRequest(CLocalSocket &client,ServeRequest &request)
+{
+	std::string line;
+	if (!client.ReceiveLine(line))
+		return false;
+
+	request.bStop = (line == std::string(PROTOCOL) + " stop");
+	if (!request.bStop && (line != std::string(PROTOCOL) + " build"))
+		return false;
+
+	request.bReturn = false;
+	request.format = IMAGE_FORMAT_MSA;
+	request.bSmallest = false;
+	request.maxFileTime = -1;
+	unsigned long zipSize = 0;
+
+	while (client.ReceiveLine(line))
+	{
+		if (!line.empty() && ('\r' == line[line.size()-1]))
+			line.erase(line.size()-1);
+		if (line.empty())
+		{
+			if (zipSize > MAX_INLINE_SIZE)
+				return false;
+			request.zip.resize(zipSize);
+			return (0 == zipSize) || client.Receive(request.zip.data(),zipSize);
+		}
+
+		size_t space = line.find(' ');
+		std::string key = line.substr(0,space);
+		std::string value = (std::string::npos == space) ? std::string() : line.substr(space + 1);
+		if ((("input" == key) || ("output" == key)) && (value.size() >= _MAX_PATH))
+			return false;			// would not fit the path buffers
+		if ("input" == key)
+			request.input = value;
+		else if ("zip" == key)
+			zipSize = strtoul(value.c_str(),NULL,10);
+		else if ("output" == key)
+			request.output = value;
+		else if ("return" == key)
+			request.bReturn = true;
+		else if ("format" == key)
+			request.format = (0 == stricmp(value.c_str(),"st")) ? IMAGE_FORMAT_ST : IMAGE_FORMAT_MSA;
+		else if ("smallest" == key)
+			request.bSmallest = true;
+		else if ("time" == key)
+			request.maxFileTime = strtoll(value.c_str(),NULL,10);
+	}
+	return false;
+}
+
+static	bool	SendReply(CLocalSocket &client,int status,const std::string &fields,const unsigned char *pData,size_t size)
+{
+	char sHeader[64];
+	sprintf(sHeader,"%s\nstatus %d ",PROTOCOL,status);
+	std::string header = std::string(sHeader) + ServeErrorString(status) + "\n" + fields + "\n";
+	return client.Send(header.data(),header.size()) && client.Send(pData,size);
+}
+
+class CServer
+{
+public:
+	CServer(const char *pSocketName,int nbThread) : m_pSocketName(pSocketName), m_pool(nbThread)	{ m_bStop = false; }
+
+	int		GetNbThread() const		{ return m_pool.GetNbThread(); }
+	bool	IsStopping() const		{ return m_bStop.load(); }
+	void	Submit(CLocalSocket *pClient);
+
+private:
+	void	Serve(CLocalSocket &client);
+	void	Build(CLocalSocket &client,const ServeRequest &request);
+
+	const char	*	m_pSocketName;
+	std::atomic<bool>	m_bStop;
+	CFloppyPool		m_floppies;
+	CTreeCache		m_trees;
+	CThreadPool		m_pool;			// last: destroyed first, once the pending builds are done
+};
+
+// The request is read by a worker, not by the accept loop: a slow client (or a big
+// inline ZIP) never holds the other ones, and the receive timeout frees the worker
+void	CServer::Submit(CLocalSocket *pClient)
+{
+	m_pool.Submit([this,pClient]
+	{
+		Serve(*pClient);
+		delete pClient;
+	});
+}
+
+void	CServer::Serve(CLocalSocket &client)
+{
+	ServeRequest request;
+	if (!client.SetReceiveTimeout(RECEIVE_TIMEOUT_MS) || !ReceiveRequest(client,request))
+		return;
+
+	if (request.bStop)
+	{
+		SendReply(client,SERVE_OK,"",NULL,0);
+		m_bStop = true;
+		CLocalSocket wake;				// the accept loop only sees m_bStop with its next connection
+		wake.Connect(m_pSocketName);
+		return;
+	}
+	Build(client,request);
+}
+
+void	CServer::Build(CLocalSocket &client,const ServeRequest &request)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	bool bInline = !request.zip.empty();
+	if ((bInline == !request.input.empty()) || (bInline && request.output.empty() && !request.bReturn))
+	{
+		SendReply(client,SERVE_BAD_REQUEST,"",NULL,0);
+		return;
+	}
+
+	CArena arena;
+	CDirectory *pRoot = NULL;
+	CFileSource *pSource = NULL;			// not owned when it comes with a cached tree
+	CachedTree *pTree = NULL;
+	bool bTreeCached = false;
+	char sImageName[_MAX_PATH];
+	sImageName[0] = 0;
+	int status = SERVE_OK;
+
+	if (bInline)
+	{
+		ZFILE *pZIP = zopenmem(request.zip.data(),(unsigned long)request.zip.size());
+		if (pZIP && zIsZIP(pZIP))
+			pRoot = CreateTreeFromZIP(pZIP,&arena);
+		if (pZIP)
+			zclose(pZIP);
+		pSource = new CZIPFileSource(request.zip.data(),(unsigned long)request.zip.size());
+	}
+	else
+	{
+		const char *pInput = request.input.c_str();
+		int pathType = HostPathType(pInput);
+		if (0 == pathType)
+			status = SERVE_BAD_PATH;
+		else if (2 == pathType)
+		{
+			pRoot = CreateTreeFromDirectory(pInput,&arena);
+			pSource = new CHostFileSource;
+		}
+		else
+		{
+			long long size = 0;
+			FILETIME time;
+			if (HostFileInfo(pInput,&size,&time))
+			{
+				pTree = m_trees.Take(pInput,size,time);
+				bTreeCached = (NULL != pTree);
+				if (NULL == pTree)
+					pTree = ScanZIP(pInput,size,time);
+			}
+			if (pTree)
+			{
+				pRoot = pTree->pRoot;
+				pSource = pTree->pSource;
+			}
+		}
+		if (request.output.empty() && !DefaultImageName(pInput,2 == pathType,request.format,sImageName) && (SERVE_OK == status))
+			status = SERVE_BAD_PATH;
+	}
+	if (!request.output.empty())
+		snprintf(sImageName,sizeof(sImageName),"%s",request.output.c_str());
+
+	if ((SERVE_OK == status) && (NULL == pRoot))
+		status = SERVE_BAD_INPUT;
+
+	const DiskGeometry *pGeometry = NULL;
+	if (SERVE_OK == status)
+	{
+		CCapacityPlan plan;
+		plan.Compute(pRoot);
+		pGeometry = plan.SelectGeometry(request.bSmallest);
+		if (NULL == pGeometry)
+			status = SERVE_NO_SPACE;
+	}
+
+	CFloppy *pFloppy = NULL;
+	if (SERVE_OK == status)
+	{
+		pFloppy = m_floppies.Take();
+		pFloppy->SetVerbosity(VERBOSE_QUIET);
+		pFloppy->SetMaxFileTime(request.maxFileTime);
+		if (!pFloppy->Create(*pGeometry) || !pFloppy->Fill(pRoot))
+			status = SERVE_NO_SPACE;
+		else if (!pFloppy->LoadFiles(pSource,&m_pool))
+			status = SERVE_READ_ERROR;
+	}
+
+	// the returned image is sent straight from the floppy buffers
+	const unsigned char *pImage = NULL;
+	size_t imageSize = 0;
+	std::vector<unsigned char> st;
+	if ((SERVE_OK == status) && request.bReturn)
+	{
+		if (IMAGE_FORMAT_ST == request.format)
+		{
+			st.resize(pFloppy->GetRawSize());
+			pFloppy->CopyST(st.data());
+			pImage = st.data();
+			imageSize = st.size();
+		}
+		else
+		{
+			imageSize = pFloppy->PackMSA(&m_pool);
+			pImage = pFloppy->GetMsaImage();
+		}
+	}
+	else if (SERVE_OK == status)
+	{
+		CImageWriter *pWriter = CImageWriter::Create(request.format);
+		if (!pWriter->Write(*pFloppy,sImageName,&m_pool))
+			status = SERVE_WRITE_ERROR;
+		delete pWriter;
+	}
+
+	char sFields[_MAX_PATH + 128];
+	double ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - t0).count();
+	if (SERVE_OK != status)
+		sprintf(sFields,"ms %.3f\n",ms);
+	else if (request.bReturn)
+		sprintf(sFields,"size %lu\nms %.3f\ntree %s\n",(unsigned long)imageSize,ms,bTreeCached ? "cached" : "scanned");
+	else
+		sprintf(sFields,"image %s\nms %.3f\ntree %s\n",sImageName,ms,bTreeCached ? "cached" : "scanned");
+	SendReply(client,status,sFields,pImage,imageSize);
+
+	if (pFloppy)
+		m_floppies.Give(pFloppy);
+	if (pTree)
+	{
+		if (SERVE_READ_ERROR == status)
+			delete pTree;				// changed while it was read: scan it again next time
+		else
+			m_trees.Give(pTree);
+	}
+	else
+		delete pSource;
+}
+
+int		RunServer(const ServerOptions &options)
+{
+	CLocalSocket listener;
+	if (!listener.Listen(options.pSocketName))
+	{
+		printf("ERROR: Could not listen on \"%s\" (a server may already be running)\n",options.pSocketName);
+		return -1;
+	}
+
+	int rCode = 0;
+	{
+		CServer server(options.pSocketName,options.nbThread);
+		printf("Serving on \"%s\" with %d thread(s)...\n",options.pSocketName,server.GetNbThread());
+		fflush(stdout);
+
+		for (;;)
+		{
+			CLocalSocket *pClient = new CLocalSocket;
+			if (!listener.Accept(*pClient))
+			{
+				delete pClient;
+				printf("ERROR: Could not accept a connection\n");
+				rCode = -1;
+				break;
+			}
+
+			if (server.IsStopping())
+			{
+				delete pClient;
+				break;
+			}
+			server.Submit(pClient);
+		}
+	}		// pending builds are done here
+
+	listener.Close();
+#ifdef _WIN32
+	DeleteFile(options.pSocketName);
+#else
+	remove(options.pSocketName);
+#endif
+	printf("Server stopped\n");
+	return rCode;
+}
+
+
+//--------------- Client -------------------------------------------------
+
+int		RunClient(const ClientOptions &options)
+{
+	CLocalSocket server;
+	if (!server.Connect(options.pSocketName))
+	{
+		printf("ERROR: No server on \"%s\"\n",options.pSocketName);
+		return -1;
+	}
+
+	std::string header = PROTOCOL;
+	std::vector<unsigned char> zip;
+	char sInput[_MAX_PATH];
+	char sImageName[_MAX_PATH];
+	if (options.bStop)
+		header += " stop\n";
+	else
+	{
+		header += " build\n";
+		if (!HostFullPath(options.pInput,sInput))
+		{
+			printf("ERROR: \"%s\" is not a valid path\n",options.pInput);
+			return -1;
+		}
+
+		if (options.bInline)
+		{	// the server may not see our files: it gets the bytes, we get the image
+			long long size = 0;
+			FILETIME time;
+			if ((1 != HostPathType(sInput)) || !HostFileInfo(sInput,&size,&time) || (size > (long long)MAX_INLINE_SIZE))
+			{
+				printf("ERROR on \"%s\":\n-inline needs a ZIP file\n",options.pInput);
+				return -1;
+			}
+			zip.resize((size_t)size);
+			if (!HostReadFile(sInput,zip.data(),zip.size()))
+			{
+				printf("ERROR: Could not read \"%s\"\n",options.pInput);
+				return -1;
+			}
+			header += "zip " + std::to_string(zip.size()) + "\nreturn\n";
+			if (options.pImageName)
+				snprintf(sImageName,sizeof(sImageName),"%s",options.pImageName);
+			else if (!DefaultImageName(options.pInput,false,options.format,sImageName))
+			{
+				printf("ERROR: \"%s\" is too long\n",options.pInput);
+				return -1;
+			}
+		}
+		else
+		{
+			header += std::string("input ") + sInput + "\n";
+			if (options.pImageName)
+			{
+				if (!HostFullPath(options.pImageName,sImageName))
+				{
+					printf("ERROR: \"%s\" is not a valid path\n",options.pImageName);
+					return -1;
+				}
+				header += std::string("output ") + sImageName + "\n";
+			}
+		}
+
+		if (IMAGE_FORMAT_ST == options.format)
+			header += "format st\n";
+		if (options.bSmallest)
+			header += "smallest\n";
+		if (options.maxFileTime >= 0)
+			header += "time " + std::to_string(options.maxFileTime) + "\n";
+	}
+	header += "\n";
+
+	std::string line;
+	if (!server.Send(header.data(),header.size()) || !server.Send(zip.data(),zip.size()) || !server.ReceiveLine(line) || (line != PROTOCOL))
+	{
+		printf("ERROR: No reply from the server\n");
+		return -1;
+	}
+
+	int status = -1;
+	std::string statusText;
+	std::string image;
+	std::string tree;
+	double ms = 0.0;
+	unsigned long size = 0;
+	while (server.ReceiveLine(line) && !line.empty())
+	{
+		size_t space = line.find(' ');
+		std::string key = line.substr(0,space);
+		std::string value = (std::string::npos == space) ? std::string() : line.substr(space + 1);
+		if ("status" == key)
+		{
+			status = atoi(value.c_str());
+			statusText = value.substr(std::min(value.size(),value.find(' ') + 1));
+		}
+		else if ("image" == key)
+			image = value;
+		else if ("size" == key)
+			size = strtoul(value.c_str(),NULL,10);
+		else if ("ms" == key)
+			ms = atof(value.c_str());
+		else if ("tree" == key)
+			tree = value;
+	}
+
+	if (options.bStop)
+	{
+		if (SERVE_OK != status)
+			return -1;
+		printf("Server stopped\n");
+		return 0;
+	}
+
+	if (SERVE_OK != status)
+	{
+		printf("ERROR on \"%s\":\n%s\n",options.pInput,statusText.c_str());
+		return -1;
+	}
+
+	if (options.bInline)
+	{
+		std::vector<unsigned char> data(size);
+		if (!server.Receive(data.data(),size))
+		{
+			printf("ERROR: No reply from the server\n");
+			return -1;
+		}
+		if (!WriteWholeFile(sImageName,data.data(),size))
+		{
+			printf("ERROR: Could not write \"%s\"\n",sImageName);
+			return -1;
+		}
+		image = sImageName;
+	}
+
+	printf("\"%s\" -> \"%s\" (%.2f ms, tree %s)\n",options.pInput,image.c_str(),ms,tree.c_str());
+	return 0;
+}
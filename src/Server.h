@@ -0,0 +1,46 @@
+
+#ifndef __SERVER__
+#define __SERVER__
+
+#include "Dir2Floppy.h"
+
+//--------------------------------------------------------------------------
+// Build server (-serve) and its client (-client).
+// The server keeps its worker pool, its floppy buffers and the trees of the
+// ZIP files it recently scanned (with their open ZIPIO handles) from one
+// request to the next, so a small image costs no process start.
+// One request per connection, over a local socket. Text header lines, an
+// empty line, then the binary data (if any):
+//   request: "DIR2MSA 1 build" (or "DIR2MSA 1 stop"), then
+//            input <path> | zip <size>    directory or ZIP file, or ZIP bytes
+//            output <path> | return       image file, or image bytes in the reply
+//            format msa|st, smallest, time <unix time>   (optional)
+//   reply:   "DIR2MSA 1", status <code> <text>, image <path> | size <size>,
+//            ms <build time>, tree cached|scanned
+//--------------------------------------------------------------------------
+
+struct ServerOptions
+{
+	const char	*	pSocketName;
+	int				nbThread;			// 0: one per core
+};
+
+// Returns when a client asks it to stop. -1 if the socket can't be created
+int		RunServer(const ServerOptions &options);
+
+struct ClientOptions
+{
+	const char	*	pSocketName;
+	const char	*	pInput;				// directory or ZIP file
+	const char	*	pImageName;			// NULL: next to the input, like the command line
+	ImageFormat		format;
+	bool			bSmallest;
+	long long		maxFileTime;		// -1: none
+	bool			bInline;			// send the ZIP bytes and get the image bytes back
+	bool			bStop;				// only ask the server to stop
+};
+
+// 0: image built, -1: error (printed)
+int		RunClient(const ClientOptions &options);
+
+#endif // __SERVER__
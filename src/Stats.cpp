@@ -0,0 +1,126 @@
+
+#include "Platform.h"
+#include <stdio.h>
+#include <chrono>
+#include "Stats.h"
+
+static	const char	*	s_phaseNames[PHASE_COUNT] = { "scan", "plan", "fill", "load", "write" };
+
+static	double	WallTime()
+{
+	return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+JobStats::JobStats()
+{
+	for (int i=0;i<PHASE_COUNT;i++)
+	{
+		wallMs[i] = 0.0;
+		cpuMs[i] = 0.0;
+	}
+	nbFileRead = 0;
+	nbByteRead = 0;
+	nbZipCompressed = 0;
+	nbZipInflated = 0;
+	nbClusterUsed = 0;
+	nbClusterFree = 0;
+	nbSlackByte = 0;
+	trackRawSize = 0;
+}
+
+CPhaseTimer::CPhaseTimer(JobStats *pStats,StatPhase phase)
+{
+	m_pStats = pStats;
+	m_phase = phase;
+	if (pStats)
+	{
+		m_wallStart = WallTime();
+		m_cpuStart = HostCpuTime();
+	}
+}
+
+CPhaseTimer::~CPhaseTimer()
+{
+	Stop();
+}
+
+void	CPhaseTimer::Stop()
+{
+	if (m_pStats)
+	{
+		double wall = WallTime();
+		double cpu = HostCpuTime();
+		m_pStats->wallMs[m_phase] += wall - m_wallStart;
+		m_pStats->cpuMs[m_phase] += cpu - m_cpuStart;
+		m_wallStart = wall;
+		m_cpuStart = cpu;
+	}
+}
+
+void	CPhaseTimer::Next(StatPhase phase)
+{
+	Stop();
+	m_phase = phase;
+}
+
+static	long long	TotalPacked(const JobStats &stats)
+{
+	long long total = 0;
+	for (size_t t=0;t<stats.trackPackedSize.size();t++)
+		total += stats.trackPackedSize[t];
+	return total;
+}
+
+void	PrintJobStats(const JobStats &stats)
+{
+	printf("  phase      wall ms     cpu ms\n");
+	for (int i=0;i<PHASE_COUNT;i++)
+		printf("  %-6s  %10.2f %10.2f\n",s_phaseNames[i],stats.wallMs[i],stats.cpuMs[i]);
+	printf("  files read: %lld (%lld bytes)\n",stats.nbFileRead,stats.nbByteRead);
+	if (stats.nbZipCompressed)
+		printf("  ZIP: %lld compressed -> %lld inflated bytes\n",stats.nbZipCompressed,stats.nbZipInflated);
+	printf("  clusters: %d used, %d free, %lld slack bytes\n",stats.nbClusterUsed,stats.nbClusterFree,stats.nbSlackByte);
+	if (!stats.trackPackedSize.empty())
+	{
+		long long raw = (long long)stats.trackRawSize * stats.trackPackedSize.size();
+		long long packed = TotalPacked(stats);
+		printf("  MSA: %d track(s), %lld -> %lld bytes (%.1f%%)\n",(int)stats.trackPackedSize.size(),raw,packed,raw ? packed * 100.0 / raw : 0.0);
+	}
+}
+
+static	void	WriteJSONString(FILE *h,const char *pStr)
+{
+	fputc('"',h);
+	for (;*pStr;pStr++)
+	{
+		unsigned char c = (unsigned char)*pStr;
+		if (('"' == c) || ('\\' == c))
+			fprintf(h,"\\%c",c);
+		else if (c < 0x20)
+			fprintf(h,"\\u%04x",c);
+		else
+			fputc(c,h);
+	}
+	fputc('"',h);
+}
+
+void	WriteJobStatsJSON(FILE *h,const JobStats &stats,const char *pInput,const char *pImage,const char *pResult)
+{
+	fprintf(h,"{\n\t\t\t\"input\": ");
+	WriteJSONString(h,pInput);
+	fprintf(h,",\n\t\t\t\"image\": ");
+	WriteJSONString(h,pImage);
+	fprintf(h,",\n\t\t\t\"result\": ");
+	WriteJSONString(h,pResult);
+	fprintf(h,",\n\t\t\t\"phases\": {");
+	for (int i=0;i<PHASE_COUNT;i++)
+		fprintf(h,"%s \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }",i ? "," : "",s_phaseNames[i],stats.wallMs[i],stats.cpuMs[i]);
+	fprintf(h," },\n");
+	fprintf(h,"\t\t\t\"files_read\": %lld,\n\t\t\t\"bytes_read\": %lld,\n",stats.nbFileRead,stats.nbByteRead);
+	fprintf(h,"\t\t\t\"zip_compressed_bytes\": %lld,\n\t\t\t\"zip_inflated_bytes\": %lld,\n",stats.nbZipCompressed,stats.nbZipInflated);
+	fprintf(h,"\t\t\t\"clusters_used\": %d,\n\t\t\t\"clusters_free\": %d,\n\t\t\t\"slack_bytes\": %lld,\n",stats.nbClusterUsed,stats.nbClusterFree,stats.nbSlackByte);
+	fprintf(h,"\t\t\t\"track_raw_size\": %d,\n\t\t\t\"track_packed_sizes\": [",stats.trackRawSize);
+	for (size_t t=0;t<stats.trackPackedSize.size();t++)
+		fprintf(h,"%s%d",t ? "," : "",stats.trackPackedSize[t]);
+	fprintf(h,"],\n\t\t\t\"packed_bytes\": %lld\n\t\t}",TotalPacked(stats));
+}
@@ -0,0 +1,67 @@
+
+#ifndef __STATS__
+#define __STATS__
+
+#include <stdio.h>
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Counters and phase timings of one build job (-stats). BuildImage times the
+// phases, CFloppy and the file sources fill the counters. Nothing is
+// recorded when the job has no JobStats.
+//--------------------------------------------------------------------------
+
+enum StatPhase
+{
+	PHASE_SCAN,			// directory walk or ZIP central directory
+	PHASE_PLAN,			// capacity plan, cache lookup
+	PHASE_FILL,			// cluster allocation and directories
+	PHASE_LOAD,			// file contents to the clusters
+	PHASE_WRITE,		// FAT, packing and image file
+	PHASE_COUNT
+};
+
+struct JobStats
+{
+	JobStats();
+
+	double		wallMs[PHASE_COUNT];
+	double		cpuMs[PHASE_COUNT];			// whole process: in a batch, includes the other jobs
+
+	long long	nbFileRead;
+	long long	nbByteRead;
+	long long	nbZipCompressed;			// of the ZIP members read
+	long long	nbZipInflated;
+
+	int			nbClusterUsed;
+	int			nbClusterFree;
+	long long	nbSlackByte;				// unused end of the last cluster of each file
+
+	int			trackRawSize;
+	std::vector<int>	trackPackedSize;	// size in the .msa of each track (empty for .st)
+};
+
+// Adds the wall and CPU time of a scope to its current phase (no-op with NULL stats)
+class CPhaseTimer
+{
+public:
+	CPhaseTimer(JobStats *pStats,StatPhase phase);
+	~CPhaseTimer();
+
+	void	Next(StatPhase phase);		// ends the current phase
+
+private:
+	void	Stop();
+
+	JobStats	*	m_pStats;
+	StatPhase		m_phase;
+	double			m_wallStart;
+	double			m_cpuStart;
+};
+
+void	PrintJobStats(const JobStats &stats);
+
+// One JSON object (no trailing newline). pInput/pImage are the job paths, pResult its status
+void	WriteJobStatsJSON(FILE *h,const JobStats &stats,const char *pInput,const char *pImage,const char *pResult);
+
+#endif // __STATS__
@@ -0,0 +1,255 @@
+
+#include <chrono>
+#include "ThreadPool.h"
+
+static	const	int		MAX_THREAD			=	16;
+static	const	int		PENDING_PER_THREAD	=	64;
+
+// Identify the pool (and the worker slot) of the calling thread
+static	thread_local	const CThreadPool	*	t_pPool = NULL;
+static	thread_local	int						t_workerIndex = -1;
+
+
+int	CThreadPool::DefaultThreadCount()
+{
+	int n = (int)std::thread::hardware_concurrency();
+	if (n <= 0)
+		n = 2;
+	if (n > MAX_THREAD)
+		n = MAX_THREAD;
+	return n;
+}
+
+CThreadPool::CThreadPool(int nbThread,int maxPending)
+{
+	if (nbThread <= 0)
+		nbThread = DefaultThreadCount();
+
+	m_maxPending = (maxPending > 0) ? maxPending : nbThread * PENDING_PER_THREAD;
+	m_nbQueued = 0;
+	m_nbPending = 0;
+	m_bQuit = false;
+
+	for (int i=0;i<nbThread;i++)
+		m_workers.push_back(new Worker);
+
+	// start the threads once every worker slot exists (they steal from each other)
+	for (int i=0;i<nbThread;i++)
+		m_workers[i]->thread = std::thread(&CThreadPool::WorkerMain,this,i);
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_jobReady.notify_all();
+
+	// join them all before freeing any slot: a worker may still be looking for something to steal
+	for (size_t i=0;i<m_workers.size();i++)
+		m_workers[i]->thread.join();
+	for (size_t i=0;i<m_workers.size();i++)
+		delete m_workers[i];
+}
+
+int		CThreadPool::GetWorkerIndex() const
+{
+	return (this == t_pPool) ? t_workerIndex : -1;
+}
+
+void	CThreadPool::Submit(const Job &job,CJobGroup *pGroup)
+{
+	Task task;
+	task.job = job;
+	task.pGroup = pGroup;
+
+	if (pGroup)
+	{
+		pGroup->m_nbPending++;
+		pGroup->m_nbQueued++;
+	}
+	m_nbPending++;
+
+	int index = GetWorkerIndex();
+	if (index >= 0)
+	{	// from a worker: never block, keep it local (others will steal if idle)
+		Worker *pWorker = m_workers[index];
+		{
+			std::lock_guard<std::mutex> lock(pWorker->mutex);
+			pWorker->tasks.push_back(task);
+		}
+		m_nbQueued++;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+	}
+	else
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_slotFree.wait(lock,[this] { return (int)m_injectQueue.size() < m_maxPending; });
+		m_injectQueue.push_back(task);
+		m_nbQueued++;
+	}
+	m_jobReady.notify_one();
+}
+
+bool	CThreadPool::PopTask(int index,Task &task)
+{
+	// own jobs first, most recent first (cache friendly)
+	Worker *pWorker = m_workers[index];
+	{
+		std::lock_guard<std::mutex> lock(pWorker->mutex);
+		if (!pWorker->tasks.empty())
+		{
+			task = pWorker->tasks.back();
+			pWorker->tasks.pop_back();
+			Dequeued(task);
+			return true;
+		}
+	}
+
+	// then jobs from outside
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_injectQueue.empty())
+		{
+			task = m_injectQueue.front();
+			m_injectQueue.pop_front();
+			Dequeued(task);
+			lock.unlock();
+			m_slotFree.notify_one();
+			return true;
+		}
+	}
+
+	// then steal the oldest job of another worker
+	int nbWorker = (int)m_workers.size();
+	for (int i=1;i<nbWorker;i++)
+	{
+		Worker *pVictim = m_workers[(index + i) % nbWorker];
+		std::lock_guard<std::mutex> lock(pVictim->mutex);
+		if (!pVictim->tasks.empty())
+		{
+			task = pVictim->tasks.front();
+			pVictim->tasks.pop_front();
+			Dequeued(task);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Only the jobs of pGroup: own deque from the back, then the other queues from the front
+bool	CThreadPool::PopGroupTask(int index,CJobGroup *pGroup,Task &task)
+{
+	if (0 == pGroup->m_nbQueued.load())
+		return false;
+
+	int nbWorker = (int)m_workers.size();
+	for (int i=0;i<nbWorker;i++)
+	{
+		Worker *pWorker = m_workers[(index + i) % nbWorker];
+		std::lock_guard<std::mutex> lock(pWorker->mutex);
+		std::deque<Task> &tasks = pWorker->tasks;
+		for (size_t j=0;j<tasks.size();j++)
+		{
+			size_t k = (0 == i) ? tasks.size() - 1 - j : j;
+			if (pGroup == tasks[k].pGroup)
+			{
+				task = tasks[k];
+				tasks.erase(tasks.begin() + k);
+				Dequeued(task);
+				return true;
+			}
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (size_t k=0;k<m_injectQueue.size();k++)
+	{
+		if (pGroup == m_injectQueue[k].pGroup)
+		{
+			task = m_injectQueue[k];
+			m_injectQueue.erase(m_injectQueue.begin() + k);
+			Dequeued(task);
+			lock.unlock();
+			m_slotFree.notify_one();
+			return true;
+		}
+	}
+	return false;
+}
+
+void	CThreadPool::Dequeued(const Task &task)
+{
+	if (task.pGroup)
+		task.pGroup->m_nbQueued--;
+	m_nbQueued--;
+}
+
+void	CThreadPool::RunTask(Task &task)
+{
+	task.job();
+
+	if (task.pGroup)
+		task.pGroup->m_nbPending--;
+	m_nbPending--;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_jobDone.notify_all();
+}
+
+void	CThreadPool::Wait(CJobGroup *pGroup)
+{
+	// Wait(NULL) from a worker would wait for its own job: only groups can be waited from inside
+	int index = GetWorkerIndex();
+
+	for (;;)
+	{
+		bool bDone = pGroup ? pGroup->IsDone() : (0 == m_nbPending.load());
+		if (bDone)
+			return;
+
+		if ((index >= 0) && pGroup)
+		{	// help with the group's own jobs instead of sleeping
+			Task task;
+			if (PopGroupTask(index,pGroup,task))
+			{
+				RunTask(task);
+				continue;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobDone.wait_for(lock,std::chrono::milliseconds(1),[this,pGroup,index]
+		{
+			if ((index >= 0) && pGroup && (pGroup->m_nbQueued.load() > 0))
+				return true;
+			return pGroup ? pGroup->IsDone() : (0 == m_nbPending.load());
+		});
+	}
+}
+
+void	CThreadPool::WorkerMain(int index)
+{
+	t_pPool = this;
+	t_workerIndex = index;
+
+	for (;;)
+	{
+		Task task;
+		if (PopTask(index,task))
+		{
+			RunTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobReady.wait(lock,[this] { return m_bQuit || (m_nbQueued.load() > 0); });
+		if (m_bQuit && (0 == m_nbQueued.load()))
+			return;
+	}
+}
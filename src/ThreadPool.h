@@ -0,0 +1,85 @@
+
+#ifndef __THREADPOOL__
+#define __THREADPOOL__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------
+// Fixed size work-stealing worker pool.
+// Each worker owns a deque: jobs submitted from a worker go to its own deque
+// (popped LIFO by the owner, stolen FIFO by idle workers), jobs submitted from
+// outside go to a shared bounded queue. An outside Submit() blocks once that
+// queue is full, so a fast producer (directory walk) can't get too far ahead
+// of the workers.
+// Jobs can be tagged with a CJobGroup. Wait(pGroup) returns when every job of
+// the group is done; when called from a worker it runs the group's own queued
+// jobs meanwhile, so nested waits (a batch job waiting for its file loads) never
+// starve, and never pick up unrelated jobs that would nest without bound.
+//--------------------------------------------------------------------------
+class CJobGroup
+{
+public:
+	CJobGroup()						{ m_nbPending = 0; m_nbQueued = 0; }
+	bool	IsDone() const			{ return 0 == m_nbPending.load(); }
+
+private:
+	friend class CThreadPool;
+	std::atomic<int>	m_nbPending;
+	std::atomic<int>	m_nbQueued;					// jobs of the group sitting in any queue
+};
+
+class CThreadPool
+{
+public:
+	typedef std::function<void()>	Job;
+
+	CThreadPool(int nbThread = 0,int maxPending = 0);		// 0: use defaults
+	~CThreadPool();
+
+	void	Submit(const Job &job,CJobGroup *pGroup = NULL);
+	void	Wait(CJobGroup *pGroup = NULL);					// NULL: wait for every submitted job
+
+	int		GetNbThread() const		{ return (int)m_workers.size(); }
+	int		GetWorkerIndex() const;							// -1 when not called from one of our workers
+
+	static	int		DefaultThreadCount();
+
+private:
+	struct Task
+	{
+		Job				job;
+		CJobGroup	*	pGroup;
+	};
+
+	struct Worker
+	{
+		std::thread			thread;
+		std::mutex			mutex;
+		std::deque<Task>	tasks;
+	};
+
+	void	WorkerMain(int index);
+	bool	PopTask(int index,Task &task);
+	bool	PopGroupTask(int index,CJobGroup *pGroup,Task &task);
+	void	Dequeued(const Task &task);
+	void	RunTask(Task &task);
+
+	std::vector<Worker*>		m_workers;
+	std::deque<Task>			m_injectQueue;
+	std::mutex					m_mutex;					// guards m_injectQueue and the condition variables
+	std::condition_variable		m_jobReady;
+	std::condition_variable		m_slotFree;
+	std::condition_variable		m_jobDone;
+	std::atomic<int>			m_nbQueued;					// tasks sitting in any queue
+	std::atomic<int>			m_nbPending;				// tasks not finished yet
+	int							m_maxPending;
+	bool						m_bQuit;
+};
+
+#endif // __THREADPOOL__